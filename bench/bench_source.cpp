@@ -0,0 +1,238 @@
+#include "bench_source.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "fmt/format.h"
+
+#include "consts.h"
+
+namespace maybe {
+
+// The file is reused across runs with the same arguments (the same name).
+template <class Make>
+static string bench_file(const string& name, Make make)
+{
+    const auto path = std::filesystem::temp_directory_path() / name;
+    if (!std::filesystem::exists(path)) {
+        // written under a temporary name so an interrupted run doesn't leave
+        // a truncated file behind
+        auto tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary);
+            f << make();
+        }
+        std::filesystem::rename(tmp, path);
+    }
+    return path.string();
+}
+
+// In the names of the corpus files, bumped when make_corpus() changes so
+// the files of the previous runs aren't reused.
+static const int c_corpus_version = 2;
+
+static const char* const c_corpus_shape_names[c_num_corpus_shapes] = {
+    "mixed",    "deep-indentation", "long-identifiers", "comments",
+    "numbers",  "strings",          "crlf"};
+
+const char* corpus_shape_name(CorpusShape shape)
+{
+    return c_corpus_shape_names[(int)shape];
+}
+
+Maybe<CorpusShape> corpus_shape_from_name(string_par name)
+{
+    for (int i = 0; i < c_num_corpus_shapes; ++i)
+        if (!strcmp(name.c_str(), c_corpus_shape_names[i]))
+            return (CorpusShape)i;
+    return Nothing;
+}
+
+// splitmix64: the corpora must not depend on the standard library's engines
+// and distributions, which differ between implementations.
+class CorpusRng
+{
+public:
+    explicit CorpusRng(uint64_t seed) : state(seed) {}
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+    // in [0, n)
+    int below(int n) { return (int)(next() % n); }
+    // in [lo, hi]
+    int between(int lo, int hi) { return lo + below(hi - lo + 1); }
+
+private:
+    uint64_t state;
+};
+
+// Not one of the keywords of the statements, so the corpora parse.
+static string identifier(CorpusRng& rng, int min_length, int max_length)
+{
+    static const char c_letters[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static const char c_letters_digits[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static const char* const c_keywords[] = {"fn", "if", "else", "while",
+                                             "return"};
+    for (;;) {
+        const int n = rng.between(min_length, max_length);
+        string s(1, c_letters[rng.below(sizeof(c_letters) - 1)]);
+        while ((int)s.size() < n)
+            s += c_letters_digits[rng.below(sizeof(c_letters_digits) - 1)];
+        if (std::find(std::begin(c_keywords), std::end(c_keywords), s) ==
+            std::end(c_keywords))
+            return s;
+    }
+}
+
+static string words(CorpusRng& rng, int count)
+{
+    string s;
+    for (int i = 0; i < count; ++i) {
+        if (i)
+            s += ' ';
+        s += identifier(rng, 2, 9);
+    }
+    return s;
+}
+
+static string number(CorpusRng& rng)
+{
+    switch (rng.below(5)) {
+        case 0:
+            return std::to_string(rng.below(100));
+        case 1:
+            return std::to_string(rng.next());
+        case 2:
+            return fmt::format("{}.{}", rng.below(100000), rng.below(1000));
+        case 3:
+            return fmt::format("{}.{}e{}{}", rng.below(10), rng.below(1000),
+                               rng.below(2) ? "-" : "", rng.below(300));
+        default:
+            return fmt::format("0x{:x}", rng.next() >> rng.below(64));
+    }
+}
+
+static string string_literal(CorpusRng& rng)
+{
+    static const char* const c_pieces[] = {
+        "\\n", "\\\"", "\\\\", "\\0", "\xc3\xa9t\xc3\xa9",
+        "\xe6\x97\xa5\xe6\x9c\xac", "%d", " "};
+    string s = "\"";
+    for (int n = rng.between(1, 8); n > 0; --n) {
+        if (rng.below(3))
+            s += words(rng, rng.between(1, 3));
+        else
+            s += c_pieces[rng.below(std::size(c_pieces))];
+    }
+    return s + "\"";
+}
+
+static void add_function(CorpusRng& rng, string& s)
+{
+    const auto f = identifier(rng, 3, 12);
+    const auto total = identifier(rng, 3, 12);
+    s += fmt::format(
+        "// {}\n"
+        "+fn {}(x: Slice[byte], n: int) -> int\n"
+        "    if #x > {} && n != 0\n"
+        "        print({}, cast(int, #x), {})\n"
+        "    {} = (n * {} + 7) / 3 - {}(x, n - 1)\n"
+        "    return {} // {}\n"
+        "\n",
+        words(rng, 4), f, number(rng), string_literal(rng), number(rng),
+        total, number(rng), f, total, words(rng, 2));
+}
+
+// A function of nested ifs down to a random depth, then back up, a
+// statement on each level.
+static void add_deep_block(CorpusRng& rng, string& s)
+{
+    const int depth = rng.between(24, 64);
+    s += fmt::format("+fn {}()\n", identifier(rng, 3, 12));
+    for (int d = 1; d <= depth; ++d) {
+        const string indent(4 * d, ' ');
+        s += fmt::format("{}if {} > {}\n", indent, identifier(rng, 1, 8),
+                         rng.below(1000));
+    }
+    for (int d = depth + 1; d > 0; d -= rng.between(1, 3)) {
+        const string indent(4 * d, ' ');
+        const auto x = identifier(rng, 1, 8);
+        s += fmt::format("{}{} = {} + {}\n", indent, x, x, rng.below(1000));
+    }
+    s += "\n";
+}
+
+static void add_lines(CorpusShape shape, CorpusRng& rng, string& s)
+{
+    switch (shape) {
+        case CorpusShape::mixed:
+        case CorpusShape::crlf:
+            add_function(rng, s);
+            break;
+        case CorpusShape::deep_indentation:
+            add_deep_block(rng, s);
+            break;
+        case CorpusShape::long_identifiers:
+            s += fmt::format("{} = {}.{}({}, {})\n", identifier(rng, 32, 128),
+                             identifier(rng, 32, 128),
+                             identifier(rng, 32, 128),
+                             identifier(rng, 32, 128),
+                             identifier(rng, 32, 128));
+            break;
+        case CorpusShape::comments:
+            s += fmt::format("// {}\n# {}\n{} = {} // {}\n",
+                             words(rng, rng.between(4, 12)),
+                             words(rng, rng.between(4, 12)),
+                             identifier(rng, 1, 8), rng.below(1000),
+                             words(rng, rng.between(2, 6)));
+            break;
+        case CorpusShape::numbers:
+            s += fmt::format("{} = {} + {} * {} - {}\n", identifier(rng, 1, 8),
+                             number(rng), number(rng), number(rng),
+                             number(rng));
+            break;
+        case CorpusShape::strings:
+            s += fmt::format("{} = {} ++ {}\n", identifier(rng, 1, 8),
+                             string_literal(rng), string_literal(rng));
+            break;
+    }
+}
+
+string make_corpus(CorpusShape shape, int bytes, uint64_t seed)
+{
+    CorpusRng rng(seed);
+    string s;
+    s.reserve(bytes + 4096);
+    while ((int)s.size() < bytes)
+        add_lines(shape, rng, s);
+    if (shape == CorpusShape::crlf) {
+        string t;
+        t.reserve(s.size() + s.size() / 16);
+        for (char c : s) {
+            if (c == c_ascii_LF)
+                t += c_ascii_CR;
+            t += c;
+        }
+        s = move(t);
+    }
+    return s;
+}
+
+string corpus_file(CorpusShape shape, int bytes, uint64_t seed)
+{
+    return bench_file(fmt::format("maybe_corpus_v{}_{}_{}_{}.src",
+                                  c_corpus_version, corpus_shape_name(shape),
+                                  bytes, seed),
+                      [=] { return make_corpus(shape, bytes, seed); });
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+
+#include "std.h"
+#include "utils.h"
+
+#include "token.h"
+
+namespace maybe {
+
+// Shapes of the synthetic corpora, each stresses a different part of the
+// front end.
+enum class CorpusShape
+{
+    mixed,             // functions with a bit of everything
+    deep_indentation,  // blocks nested dozens of levels deep
+    long_identifiers,
+    comments,  // mostly comment lines and trailing comments
+    numbers,   // integers, decimals, exponents, hex
+    strings,   // string literals with escapes and non-ASCII chars
+    crlf,      // mixed with CRLF line ends
+};
+static const int c_num_corpus_shapes = 7;
+
+const char* corpus_shape_name(CorpusShape shape);
+Maybe<CorpusShape> corpus_shape_from_name(string_par name);
+
+// Synthetic source of `shape` of about `bytes` bytes (whole lines). The same
+// arguments give the same chars on every platform.
+string make_corpus(CorpusShape shape, int bytes, uint64_t seed = 1);
+// The same in a file in the temp directory (reused across runs).
+string corpus_file(CorpusShape shape, int bytes, uint64_t seed = 1);
+
+// Pipeline stage (see TokenBatchSource) reading tokens from memory.
+class TokenVectorStage
+{
+public:
+    explicit TokenVectorStage(const vector<Token>& tokens) : tokens(tokens) {}
+    int fill(span<Token> out)
+    {
+        const int n = std::min<size_t>(out.size(), tokens.size() - next);
+        std::copy_n(tokens.begin() + next, n, out.begin());
+        next += n;
+        return n;
+    }
+
+private:
+    const vector<Token>& tokens;
+    size_t next = 0;
+};
+}
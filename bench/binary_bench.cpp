@@ -0,0 +1,269 @@
+#include <cstring>
+#include <set>
+
+#include "benchmark/benchmark.h"
+
+#include "bench_source.h"
+#include "binaryformat.h"
+#include "compiler.h"
+#include "filereader.h"
+#include "log.h"
+#include "parser.h"
+#include "tokenizer.h"
+
+using namespace maybe;
+
+// Loading the binary files written by --emit (see binaryformat.h) of the
+// synthetic corpora and walking their records. The first load of each file
+// is checked against the front end run in memory, record by record.
+
+namespace {
+
+const int c_corpus_bytes = 4 << 20;
+
+void corpus_args(benchmark::internal::Benchmark* b)
+{
+    for (int i = 0; i < c_num_corpus_shapes; ++i)
+        b->Args({i, c_corpus_bytes});
+}
+
+// The results of the front end in memory: the tokens passed to the parser,
+// their payloads and the syntax tree.
+struct FrontEnd
+{
+    uptr<FileReader> fr;  // the string literals point into its chars
+    vector<Token> tokens;
+    TokenPayloads payloads;
+    uptr<Parser> parser;
+    bool ok = false;
+};
+
+void run_front_end(const string& filename, FrontEnd& fe)
+{
+    auto fr = FileReader::new_(filename);
+    CHECK(is_right(fr), "can't open", filename);
+    fe.fr = make_unique<FileReader>(move(right(fr)));
+    Tokenizer tokenizer(*fe.fr, filename, true);
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int n = tokenizer.fill(make_span(batch.data(), batch.size())))
+        fe.tokens.insert(fe.tokens.end(), batch.begin(), batch.begin() + n);
+    fe.payloads = move(tokenizer.payloads);
+    TokenVectorStage stage(fe.tokens);
+    TokenBatchSourceOf<TokenVectorStage> source(stage);
+    BufferedOutput output;  // the diagnostics are dropped
+    BufferedOutputScope bos(output);
+    fe.parser = Parser::new_(source, fe.payloads, filename);
+    fe.ok = fe.parser->parse_toplevel_loop();
+}
+
+bool same_chars(cspan x, cspan y)
+{
+    return x.size() == y.size() && !memcmp(x.data(), y.data(), x.size());
+}
+
+bool same_name(Symbol s, const BinaryFile& file, uint32_t index)
+{
+    const auto& name = symbol_str(s);
+    return same_chars(make_span(name.data(), name.size()),
+                      file.symbol_name(index));
+}
+
+// The payload of the number, string literal or error token `x` of the front
+// end and of `y` of the file.
+bool same_payload(const Token& x,
+                  const TokenPayloads& payloads,
+                  const Token& y,
+                  const BinaryFile& file)
+{
+    switch (x.kind) {
+        case Token::number:
+            return payloads.number(x) == file.number(y);
+        case Token::string_literal:
+            return same_chars(payloads.raw_string_literal(x),
+                              file.raw_string_literal(y));
+        case Token::error: {
+            const auto& xe = payloads.error(x);
+            const auto ye = file.error(y);
+            return xe.filename == ye.filename && xe.msg == ye.msg &&
+                   xe.line_num == ye.line_num && xe.col == ye.col &&
+                   xe.length == ye.length;
+        }
+        default:
+            return true;
+    }
+}
+
+void check_tokens(const FrontEnd& fe, const BinaryFile& file)
+{
+    CHECK(file.contents() == BinaryContents::tokens && file.ok() == fe.ok);
+    const auto tokens = file.tokens();
+    CHECK(tokens.size() == fe.tokens.size(), "token count", tokens.size(),
+          fe.tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        auto x = fe.tokens[i];
+        const auto& y = tokens[i];
+        if (x.kind == Token::word) {
+            CHECK(y.kind == Token::word && same_name(x.symbol(), file, y.data),
+                  "word", i);
+            x.data = y.data;
+        }
+        CHECK(x == y && same_payload(x, fe.payloads, y, file), "token", i);
+    }
+}
+
+bool same_range(AstRange x, AstRange y)
+{
+    return x.begin == y.begin && x.size == y.size;
+}
+
+void check_ast(const FrontEnd& fe, const BinaryFile& file)
+{
+    CHECK(file.contents() == BinaryContents::ast && file.ok() == fe.ok);
+    const auto& ast = fe.parser->syntax_tree();
+    const auto nodes = file.nodes();
+    CHECK(nodes.size() == ast.nodes.size(), "node count", nodes.size(),
+          ast.nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const auto &x = ast.nodes[i], &y = nodes[i];
+        CHECK(x.kind == y.kind && x.sub == y.sub &&
+                  same_range(x.children, y.children),
+              "node", i);
+        switch (x.kind) {
+            case AstNode::function:
+            case AstNode::function_arg:
+            case AstNode::identifier:
+            case AstNode::prefix:
+            case AstNode::binary:
+                CHECK(same_name((Symbol)x.data, file, y.data), "name", i);
+                break;
+            case AstNode::number:
+            case AstNode::string_literal:
+                CHECK(same_payload(x.literal_token(), fe.payloads,
+                                   y.literal_token(), file),
+                      "literal", i);
+                break;
+            default:
+                CHECK(x.data == y.data, "node", i);
+        }
+    }
+    const auto child_ids = file.child_ids();
+    const auto toplevel = file.toplevel();
+    CHECK(std::equal(child_ids.begin(), child_ids.end(), ast.child_ids.begin(),
+                     ast.child_ids.end()),
+          "child ids");
+    CHECK(std::equal(toplevel.begin(), toplevel.end(), ast.toplevel.begin(),
+                     ast.toplevel.end()),
+          "toplevel");
+}
+
+// The binary file of the corpus of `state` written by the driver, checked
+// the first time. The size of the source is in `source_bytes`.
+string emitted_file(benchmark::State& state,
+                    Emit emit,
+                    int64_t& source_bytes)
+{
+    const auto shape = (CorpusShape)state.range(0);
+    state.SetLabel(corpus_shape_name(shape));
+    const auto filename = corpus_file(shape, state.range(1));
+    auto fr = FileReader::new_(filename);
+    CHECK(is_right(fr), "can't open", filename);
+    source_bytes = right(fr).mapped_span().size();
+
+    const bool tokens = emit == Emit::tokens_bin;
+    const auto path = filename + (tokens ? ".tokens.bin" : ".ast.bin");
+    static std::set<string> checked;
+    if (checked.count(path))
+        return path;
+    CommandLine cl;
+    cl.emit = emit;
+    {
+        BufferedOutput output;  // the diagnostics are dropped
+        BufferedOutputScope bos(output);
+        compile_file(cl, filename, 1);
+    }
+    FrontEnd fe;
+    run_front_end(filename, fe);
+    auto file = BinaryFile::load(path);
+    CHECK(is_right(file), "can't load", path);
+    if (tokens)
+        check_tokens(fe, right(file));
+    else
+        check_ast(fe, right(file));
+    checked.insert(path);
+    return path;
+}
+
+// `bytes` of source and `records` per iteration
+void set_rates(benchmark::State& state, int64_t bytes, int64_t records)
+{
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.counters["records/s"] = benchmark::Counter(
+        records, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Loading the tokens and reading the names and the payloads of all of
+// them.
+void BM_load_tokens(benchmark::State& state)
+{
+    int64_t bytes = 0;
+    const auto path = emitted_file(state, Emit::tokens_bin, bytes);
+    int64_t num_tokens = 0;
+    for (auto _ : state) {
+        auto file = BinaryFile::load(path);
+        CHECK(is_right(file), "can't load", path);
+        const auto& f = right(file);
+        size_t chars = 0, ints = 0;
+        for (auto& t : f.tokens()) {
+            switch (t.kind) {
+                case Token::word:
+                    chars += f.symbol_name(t.data).size();
+                    break;
+                case Token::number:
+                    ints += holds_alternative<uint64_t>(f.number(t));
+                    break;
+                case Token::string_literal:
+                    chars += f.raw_string_literal(t).size();
+                    break;
+                default:
+                    break;
+            }
+        }
+        benchmark::DoNotOptimize(chars);
+        benchmark::DoNotOptimize(ints);
+        num_tokens = f.tokens().size();
+    }
+    set_rates(state, bytes, num_tokens);
+}
+
+// Loading the AST and walking it from the toplevel nodes.
+void BM_load_ast(benchmark::State& state)
+{
+    int64_t bytes = 0;
+    const auto path = emitted_file(state, Emit::ast_bin, bytes);
+    int64_t num_nodes = 0;
+    vector<AstNodeId> stack;
+    for (auto _ : state) {
+        auto file = BinaryFile::load(path);
+        CHECK(is_right(file), "can't load", path);
+        const auto& f = right(file);
+        const auto nodes = f.nodes();
+        const auto child_ids = f.child_ids();
+        const auto toplevel = f.toplevel();
+        stack.assign(toplevel.begin(), toplevel.end());
+        int64_t visited = 0;
+        while (!stack.empty()) {
+            const auto& n = nodes[stack.back()];
+            stack.pop_back();
+            ++visited;
+            for (uint32_t i = 0; i < n.children.size; ++i)
+                stack.push_back(child_ids[n.children.begin + i]);
+        }
+        benchmark::DoNotOptimize(visited);
+        num_nodes = nodes.size();
+    }
+    set_rates(state, bytes, num_nodes);
+}
+}
+
+BENCHMARK(BM_load_tokens)->Apply(corpus_args);
+BENCHMARK(BM_load_ast)->Apply(corpus_args);
@@ -0,0 +1,53 @@
+// Writes a synthetic corpus (see make_corpus()) to the standard output, for
+// profiling the compiler on the same inputs as the benchmarks:
+//
+//     maybe_corpus <shape> <size>[k|M] [<seed>]
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "bench_source.h"
+
+using namespace maybe;
+
+static bool parse_size(const char* a, int& size)
+{
+    char* end = nullptr;
+    long n = strtol(a, &end, 10);
+    if (end == a || n < 0)
+        return false;
+    if (*end == 'k' || *end == 'M')
+        n <<= *end++ == 'k' ? 10 : 20;
+    if (*end || n > INT_MAX / 2)
+        return false;
+    size = (int)n;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    Maybe<CorpusShape> shape;
+    int size = 0;
+    if (argc < 3 || argc > 4 || !(shape = corpus_shape_from_name(argv[1])) ||
+        !parse_size(argv[2], size)) {
+        fprintf(stderr, "Usage: %s <shape> <size>[k|M] [<seed>]\nShapes:",
+                argv[0]);
+        for (int i = 0; i < c_num_corpus_shapes; ++i)
+            fprintf(stderr, " %s", corpus_shape_name((CorpusShape)i));
+        fprintf(stderr, "\n");
+        return EXIT_FAILURE;
+    }
+    const uint64_t seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1;
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    const auto s = make_corpus(*shape, size, seed);
+    if (fwrite(s.data(), 1, s.size(), stdout) != s.size())
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,280 @@
+#include <cstring>
+#include <map>
+#include <set>
+
+#include "fmt/format.h"
+
+#include "benchmark/benchmark.h"
+
+#include "bench_source.h"
+#include "filereader.h"
+#include "parser.h"
+#include "tokenimplicitinserter.h"
+#include "tokenizer.h"
+#include "tokendump.h"
+
+using namespace maybe;
+
+// The front-end stages on the synthetic corpora, one run per corpus shape.
+// The rates are MB/s (bytes_per_second) and tokens/s. Before the first run
+// on a corpus the Tokenizer inserting the implicit tokens is checked against
+// the Tokenizer -> TokenImplicitInserter pipeline.
+
+namespace {
+
+const int c_corpus_bytes = 4 << 20;
+
+void corpus_args(benchmark::internal::Benchmark* b)
+{
+    for (int i = 0; i < c_num_corpus_shapes; ++i)
+        b->Args({i, c_corpus_bytes});
+}
+
+string corpus(benchmark::State& state)
+{
+    const auto shape = (CorpusShape)state.range(0);
+    state.SetLabel(corpus_shape_name(shape));
+    return corpus_file(shape, state.range(1));
+}
+
+FileReader open(const string& filename)
+{
+    auto fr = FileReader::new_(filename);
+    CHECK(is_right(fr), "can't open", filename);
+    return move(right(fr));
+}
+
+// `bytes` and `tokens` per iteration, no tokens/s if 0
+void set_rates(benchmark::State& state, int64_t bytes, int64_t tokens)
+{
+    state.SetBytesProcessed(state.iterations() * bytes);
+    if (tokens > 0) {
+        state.counters["tokens/s"] = benchmark::Counter(
+            tokens, benchmark::Counter::kIsIterationInvariantRate);
+    }
+}
+
+template <class Stage>
+int64_t drain(Stage& stage)
+{
+    int64_t num_tokens = 0;
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int n = stage.fill(make_span(batch.data(), batch.size())))
+        num_tokens += n;
+    return num_tokens;
+}
+
+// Opening (mapping and validating) and reading all chars, the Tokenizer's
+// upper bound.
+void BM_file_reader(benchmark::State& state)
+{
+    const auto filename = corpus(state);
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        auto fr = open(filename);
+        int64_t lines = 0;
+        do {
+            for (const char* p = fr.cursor();
+                 (p = (const char*)memchr(p, c_ascii_LF, fr.buf_end() - p));
+                 ++p)
+                ++lines;
+            bytes = fr.chars_read() + (fr.buf_end() - fr.cursor());
+            fr.advance_to(fr.buf_end());
+        } while (fr.refill());
+        benchmark::DoNotOptimize(lines);
+    }
+    set_rates(state, bytes, 0);
+}
+
+void BM_tokenizer(benchmark::State& state)
+{
+    const auto filename = corpus(state);
+    int64_t bytes = 0, tokens = 0;
+    for (auto _ : state) {
+        auto fr = open(filename);
+        Tokenizer tokenizer(fr, filename);
+        tokens = drain(tokenizer);
+        bytes = fr.chars_read();
+    }
+    set_rates(state, bytes, tokens);
+}
+
+// Checks that the Tokenizer inserting the implicit tokens gives the tokens
+// of the Tokenizer -> TokenImplicitInserter pipeline on the chars of `fr1`
+// and `fr2` (the same ones).
+void check_implicit_tokens(FileReader& fr1,
+                           FileReader& fr2,
+                           const string& filename)
+{
+    Tokenizer fused(fr1, filename, true);
+    Tokenizer tokenizer(fr2, filename);
+    TokenImplicitInserter<Tokenizer> beti(tokenizer);
+    array<Token, c_tokenizer_batch_size> xs, ys;
+    for (int64_t index = 0;;) {
+        const int nx = fused.fill(make_span(xs.data(), xs.size()));
+        const int ny = beti.fill(make_span(ys.data(), ys.size()));
+        for (int i = 0; i < std::max(nx, ny); ++i, ++index) {
+            CHECK(i < nx && i < ny &&
+                      same_token(xs[i], fused.payloads, ys[i],
+                                 tokenizer.payloads),
+                  filename, "token", index, "the tokenizer gives",
+                  i < nx ? to_string(xs[i], fused.payloads) : "none",
+                  "the inserter stage",
+                  i < ny ? to_string(ys[i], tokenizer.payloads) : "none");
+        }
+        if (nx == 0)
+            return;
+    }
+}
+
+// Sources with the corner cases of the indentation which the corpora lack.
+const char* const c_implicit_token_sources[] = {
+    "",
+    "\n\n",
+    "a",
+    "a\n    b\n        c\nd",
+    "a\n    b\n  c\n    d\n",
+    "a\n\n    b\n\n\n    c\n\n",
+    "a\n    // comment\n  # comment\n    b\n",
+    "a\n\tb\n \tc\n",
+    "a\r\n    b\r\n\r\nc\r\n",
+    "a\n    b = \"abc\n    c\n",
+    "a\n    b \x01\n    c\n",
+    "    a\n  b\n",
+};
+
+void check_implicit_tokens(const string& filename)
+{
+    static std::set<string> checked;
+    if (checked.empty()) {
+        for (auto chars : c_implicit_token_sources) {
+            const cspan cs(chars, strlen(chars));
+            const auto name = fmt::format("source {:?}", chars);
+            auto fr1 = FileReader::from_chars(cs, name);
+            auto fr2 = FileReader::from_chars(cs, name);
+            check_implicit_tokens(fr1, fr2, name);
+        }
+    }
+    if (!checked.insert(filename).second)
+        return;
+    auto fr1 = open(filename);
+    auto fr2 = open(filename);
+    check_implicit_tokens(fr1, fr2, filename);
+}
+
+// The Tokenizer inserting the implicit tokens itself.
+void BM_tokenizer_implicit_tokens(benchmark::State& state)
+{
+    const auto filename = corpus(state);
+    check_implicit_tokens(filename);
+    int64_t bytes = 0, tokens = 0;
+    for (auto _ : state) {
+        auto fr = open(filename);
+        Tokenizer tokenizer(fr, filename, true);
+        tokens = drain(tokenizer);
+        bytes = fr.chars_read();
+    }
+    set_rates(state, bytes, tokens);
+}
+
+// The TokenImplicitInserter alone, on tokens read from memory.
+void BM_implicit_inserter(benchmark::State& state)
+{
+    const auto filename = corpus(state);
+    static std::map<string, vector<Token>> cache;
+    auto& input = cache[filename];
+    auto fr = open(filename);
+    const int64_t bytes = fr.mapped_span().size();
+    if (input.empty()) {
+        Tokenizer tokenizer(fr, filename);
+        array<Token, c_tokenizer_batch_size> batch;
+        while (int n = tokenizer.fill(make_span(batch.data(), batch.size())))
+            input.insert(input.end(), batch.begin(), batch.begin() + n);
+    }
+    int64_t tokens = 0;
+    for (auto _ : state) {
+        TokenVectorStage source(input);
+        TokenImplicitInserter<TokenVectorStage> beti(source);
+        tokens = drain(beti);
+    }
+    set_rates(state, bytes, tokens);
+}
+
+// Tokenizer -> TokenImplicitInserter read through a TokenBatchSource, the
+// way the parser reads them.
+void BM_token_pipeline(benchmark::State& state)
+{
+    const auto filename = corpus(state);
+    int64_t bytes = 0, tokens = 0;
+    for (auto _ : state) {
+        auto fr = open(filename);
+        Tokenizer tokenizer(fr, filename);
+        TokenImplicitInserter<Tokenizer> beti(tokenizer);
+        TokenBatchSourceOf<TokenImplicitInserter<Tokenizer>> source(beti);
+        tokens = drain(source);
+        bytes = fr.chars_read();
+    }
+    set_rates(state, bytes, tokens);
+}
+
+// The Parser on the tokens of the pipeline read from memory, the corpora
+// have no syntax errors.
+void BM_parser(benchmark::State& state)
+{
+    const auto filename = corpus(state);
+    auto fr = open(filename);
+    const int64_t bytes = fr.mapped_span().size();
+    // the payloads refer to the chars of `fr`
+    Tokenizer tokenizer(fr, filename);
+    TokenImplicitInserter<Tokenizer> beti(tokenizer);
+    vector<Token> input;
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int n = beti.fill(make_span(batch.data(), batch.size())))
+        input.insert(input.end(), batch.begin(), batch.begin() + n);
+    for (auto _ : state) {
+        TokenVectorStage stage(input);
+        TokenBatchSourceOf<TokenVectorStage> source(stage);
+        auto parser = Parser::new_(source, tokenizer.payloads, filename);
+        CHECK(parser->parse_toplevel_loop(), "syntax errors in", filename);
+        benchmark::DoNotOptimize(parser->syntax_tree().nodes.size());
+    }
+    set_rates(state, bytes, input.size());
+}
+
+int64_t dumped_chars = 0;
+
+// The --dump-tokens writer on the tokens of the pipeline, the dump is
+// counted and dropped.
+void BM_token_dump(benchmark::State& state)
+{
+    const auto filename = corpus(state);
+    auto fr = open(filename);
+    const int64_t bytes = fr.mapped_span().size();
+    // the payloads refer to the chars of `fr`
+    Tokenizer tokenizer(fr, filename);
+    TokenImplicitInserter<Tokenizer> beti(tokenizer);
+    vector<Token> input;
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int n = beti.fill(make_span(batch.data(), batch.size())))
+        input.insert(input.end(), batch.begin(), batch.begin() + n);
+    for (auto _ : state) {
+        TokenDumpWriter writer(tokenizer.payloads,
+                               [](const char*, size_t size) {
+                                   dumped_chars += size;
+                               });
+        TokenVectorStage source(input);
+        while (int n = source.fill(make_span(batch.data(), batch.size())))
+            writer.write(make_span(batch.data(), n));
+    }
+    benchmark::DoNotOptimize(dumped_chars);
+    set_rates(state, bytes, input.size());
+}
+}
+
+BENCHMARK(BM_file_reader)->Apply(corpus_args);
+BENCHMARK(BM_tokenizer)->Apply(corpus_args);
+BENCHMARK(BM_tokenizer_implicit_tokens)->Apply(corpus_args);
+BENCHMARK(BM_implicit_inserter)->Apply(corpus_args);
+BENCHMARK(BM_token_pipeline)->Apply(corpus_args);
+BENCHMARK(BM_parser)->Apply(corpus_args);
+BENCHMARK(BM_token_dump)->Apply(corpus_args);
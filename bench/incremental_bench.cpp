@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <random>
+
+#include "benchmark/benchmark.h"
+
+#include "bench_source.h"
+#include "incrementaltokenizer.h"
+
+using namespace maybe;
+
+namespace {
+
+// Random edits of the mixed corpus, each followed by the check against a
+// fresh Tokenizer (see IncrementalTokenizer::check_tokens()). Done once,
+// before the first benchmark.
+void check_random_edits()
+{
+    static bool checked = false;
+    if (checked)
+        return;
+    static const char* const c_snippets[] = {
+        "\n", "\r\n", "  ", "\t", "x", "foo ", "+", "(", ")", "123", "4.5e3",
+        "\"ab\\\\c\"", "\"", "// c", "\n    y = 1", "\xc3\xa9", ";", "\x01"};
+    const auto text = make_corpus(CorpusShape::mixed, 8 << 10);
+    IncrementalTokenizer it("bench", make_span(text.data(), text.size()),
+                            true);
+    std::mt19937 rng(1);
+    for (int i = 0; i < 2000; ++i) {
+        const int size = it.text().size();
+        const int begin = rng() % (size + 1);
+        const int end = std::min<int>(size, begin + rng() % 8);
+        string replacement;
+        for (int k = rng() % 3; k > 0; --k)
+            replacement += c_snippets[rng() % std::size(c_snippets)];
+        it.edit(begin, end, make_span(replacement.data(), replacement.size()));
+    }
+    checked = true;
+}
+
+void edit(IncrementalTokenizer& it, int begin, int end, const string& chars)
+{
+    it.edit(begin, end, make_span(chars.data(), chars.size()));
+}
+
+// The Tokenizer stops at its first error, `it` has one at `line_num`,
+// `col`.
+void check_error_at(const IncrementalTokenizer& it, int line_num, int col)
+{
+    const auto& tokens = it.tokens();
+    auto t = std::find_if(tokens.begin(), tokens.end(), [](const Token& t) {
+        return t.kind == Token::error;
+    });
+    CHECK(t != tokens.end(), "no error token");
+    const auto& e = it.payloads().error(*t);
+    CHECK(e.line_num == line_num && e.col == col && t->col == col,
+          "error at", e.line_num, e.col, t->col, "instead of", line_num, col);
+}
+
+// The column of an invalid char after some text on its line, as edits
+// before it on the line and above it move it. The fresh Tokenizer of
+// check_tokens() is checked against the position of the char.
+void check_error_columns()
+{
+    static bool checked = false;
+    if (checked)
+        return;
+    const auto text = make_corpus(CorpusShape::mixed, 8 << 10);
+    IncrementalTokenizer it("bench", make_span(text.data(), text.size()),
+                            true);
+    const int begin = text.find('\n', text.size() / 2) + 1;
+    const int line_num = std::count(text.begin(), text.begin() + begin, '\n');
+    edit(it, begin, begin, "ab = \x01\n");
+    check_error_at(it, line_num + 1, 6);
+    edit(it, begin, begin, "xyz");
+    check_error_at(it, line_num + 1, 9);
+    edit(it, begin + 3, begin + 8, "");  // "ab = "
+    check_error_at(it, line_num + 1, 4);
+    edit(it, 0, 0, "x\n");
+    check_error_at(it, line_num + 2, 4);
+    checked = true;
+}
+
+// Typing a char in the middle of the mixed corpus of `state.range(0)`
+// bytes and deleting it.
+void BM_incremental_edit(benchmark::State& state)
+{
+    check_random_edits();
+    check_error_columns();
+    const auto text = make_corpus(CorpusShape::mixed, state.range(0));
+    IncrementalTokenizer it("bench", make_span(text.data(), text.size()));
+    const int pos = text.find('\n', text.size() / 2);
+    const char c = 'x';
+    int64_t lines = 0;
+    for (auto _ : state) {
+        lines += it.edit(pos, pos, make_span(&c, 1));
+        lines += it.edit(pos, pos + 1, make_span(&c, 0));
+    }
+    state.SetItemsProcessed(2 * state.iterations());
+    state.counters["lines_per_edit"] =
+        benchmark::Counter(lines / 2.0, benchmark::Counter::kAvgIterations);
+}
+
+// The same edits tokenizing the whole text.
+void BM_full_retokenize(benchmark::State& state)
+{
+    auto text = make_corpus(CorpusShape::mixed, state.range(0));
+    const int pos = text.find('\n', text.size() / 2);
+    for (auto _ : state) {
+        text.insert(pos, 1, 'x');
+        IncrementalTokenizer it1("bench", make_span(text.data(), text.size()));
+        text.erase(pos, 1);
+        IncrementalTokenizer it2("bench", make_span(text.data(), text.size()));
+        benchmark::DoNotOptimize(it1.tokens().data());
+        benchmark::DoNotOptimize(it2.tokens().data());
+    }
+    state.SetItemsProcessed(2 * state.iterations());
+}
+}
+
+BENCHMARK(BM_incremental_edit)->Arg(32 << 10)->Arg(2 << 20);
+BENCHMARK(BM_full_retokenize)->Arg(32 << 10)->Arg(2 << 20);
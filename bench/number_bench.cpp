@@ -0,0 +1,122 @@
+#include <cstdlib>
+
+#include "benchmark/benchmark.h"
+
+#include "bench_source.h"
+#include "filereader.h"
+#include "numberliteral.h"
+#include "tokenizer.h"
+
+using namespace maybe;
+
+namespace {
+
+// Tokenizes the numbers corpus of `state.range(0)` bytes.
+void BM_tokenize_numbers(benchmark::State& state)
+{
+    const auto filename = corpus_file(CorpusShape::numbers, state.range(0));
+    int64_t num_tokens = 0;
+    for (auto _ : state) {
+        auto fr = FileReader::new_(filename);
+        CHECK(is_right(fr), "can't open", filename);
+        Tokenizer tokenizer(right(fr), filename);
+        array<Token, c_tokenizer_batch_size> batch;
+        while (int n = tokenizer.fill(make_span(batch.data(), batch.size())))
+            num_tokens += n;
+        benchmark::DoNotOptimize(tokenizer.payloads.numbers.data());
+    }
+    state.SetItemsProcessed(num_tokens);
+}
+
+const vector<string> c_literals = {"0",
+                                   "7",
+                                   "42",
+                                   "65535",
+                                   "3.25",
+                                   "0.1",
+                                   "1.5e3",
+                                   "2.5e-7",
+                                   "6.02e23",
+                                   "18446744073709551615",
+                                   "123.456",
+                                   "3.14159265358979323846264338327950288",
+                                   "1e-300",
+                                   "299792458"};
+
+// the value of a decimal literal with DecimalLiteral
+Nonnegative decimal_value(const string& s)
+{
+    DecimalLiteral lit;
+    auto p = s.c_str();
+    for (; '0' <= *p && *p <= '9'; ++p)
+        lit.add_digit(*p - '0');
+    if (*p == '.')
+        for (++p; '0' <= *p && *p <= '9'; ++p)
+            lit.add_fraction_digit(*p - '0');
+    if (*p == 'e')
+        lit.set_exponent(atoi(p + 1));
+    return lit.value();
+}
+
+// The integral forms are exact uint64_t values, the others the long double
+// of strtold. Checked once, before the first benchmark.
+void check_decimal_literals()
+{
+    static bool checked = false;
+    if (checked)
+        return;
+    const std::pair<const char*, uint64_t> c_integral[] = {
+        {"0.0", 0},
+        {"1.0", 1},
+        {"10.00", 10},
+        {"2.50e1", 25},
+        {"1.5e3", 1500},
+        {"123.4560e3", 123456},
+        {"100e-2", 1},
+        {"7e0", 7},
+        {"18446744073709551615.000", 18446744073709551615u},
+        {"1844674407370955161.50e1", 18446744073709551615u}};
+    for (auto& x : c_integral) {
+        const auto v = decimal_value(x.first);
+        CHECK(holds_alternative<uint64_t>(v) && get<uint64_t>(v) == x.second,
+              "not an integer", x.first);
+    }
+    for (auto& s : c_literals) {
+        const auto v = decimal_value(s);
+        const long double expected = strtold(s.c_str(), nullptr);
+        if (holds_alternative<uint64_t>(v))
+            CHECK((long double)get<uint64_t>(v) == expected, s);
+        else
+            CHECK(get<long double>(v) == expected &&
+                      (expected >= 0x1p64L ||
+                       expected != (uint64_t)expected),
+                  s);
+    }
+    checked = true;
+}
+
+// The literal conversion alone: DecimalLiteral vs strtold which the
+// Tokenizer used before.
+void BM_decimal_literal(benchmark::State& state)
+{
+    check_decimal_literals();
+    for (auto _ : state) {
+        for (auto& s : c_literals)
+            benchmark::DoNotOptimize(decimal_value(s));
+    }
+    state.SetItemsProcessed(state.iterations() * c_literals.size());
+}
+
+void BM_strtold(benchmark::State& state)
+{
+    for (auto _ : state) {
+        for (auto& s : c_literals)
+            benchmark::DoNotOptimize(strtold(s.c_str(), nullptr));
+    }
+    state.SetItemsProcessed(state.iterations() * c_literals.size());
+}
+}
+
+BENCHMARK(BM_tokenize_numbers)->Arg(1 << 20);
+BENCHMARK(BM_decimal_literal);
+BENCHMARK(BM_strtold);
@@ -0,0 +1,150 @@
+#include <map>
+
+#include "fmt/format.h"
+
+#include "benchmark/benchmark.h"
+
+#include "bench_source.h"
+#include "filereader.h"
+#include "log.h"
+#include "parser.h"
+#include "tokenimplicitinserter.h"
+#include "tokenizer.h"
+
+using namespace maybe;
+
+// The expression parser on single lines of `n` operands. The deepest ones
+// would overflow the native stack of a recursive descent parser, the Pratt
+// parser keeps its operands and operators on the heap. The Complexity()
+// fits show the time is linear in the size.
+
+namespace {
+
+enum ExpressionShape
+{
+    nested_parens,  // x = ((((a + 1) * 2) + 3) ...)
+    right_nested,   // x = a + (a * (a + (a ...)))
+    flat_chain,     // x = a + b * c - d ...
+    prefix_chain,   // x = - ! - ! ... a
+};
+
+string make_expression(ExpressionShape shape, int n)
+{
+    static const char* const c_ops[] = {"+", "*", "-", "/"};
+    string s = "x = ";
+    switch (shape) {
+        case nested_parens:
+            s.append(n, '(');
+            s += "a";
+            for (int i = 0; i < n; ++i)
+                s += fmt::format(" {} {})", c_ops[i % 4], i);
+            break;
+        case right_nested:
+            for (int i = 0; i < n; ++i)
+                s += fmt::format("a {} (", c_ops[i % 4]);
+            s += "a";
+            s.append(n, ')');
+            break;
+        case flat_chain:
+            for (int i = 0; i < n; ++i)
+                s += fmt::format("a{} {} ", i % 100, c_ops[i % 4]);
+            s += "a";
+            break;
+        case prefix_chain:
+            for (int i = 0; i < n; ++i)
+                s += i % 2 ? "! " : "- ";
+            s += "a";
+            break;
+    }
+    return s + "\n";
+}
+
+// The tokens of an expression read by the parser, after the implicit
+// tokens.
+struct TokenizedExpression
+{
+    uptr<FileReader> fr;  // the string literals point into its chars
+    vector<Token> tokens;
+    TokenPayloads payloads;
+};
+
+void tokenize(const string& text, TokenizedExpression& x)
+{
+    x.fr = make_unique<FileReader>(
+        FileReader::from_chars(make_span(text.data(), text.size()), "bench"));
+    Tokenizer tokenizer(*x.fr, "bench", true);
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int k = tokenizer.fill(make_span(batch.data(), batch.size())))
+        x.tokens.insert(x.tokens.end(), batch.begin(), batch.begin() + k);
+    x.payloads = move(tokenizer.payloads);
+}
+
+const TokenizedExpression& tokenized_expression(ExpressionShape shape, int n)
+{
+    static std::map<std::pair<int, int>, TokenizedExpression> cache;
+    auto& x = cache[{shape, n}];
+    if (!x.fr)
+        tokenize(make_expression(shape, n), x);
+    return x;
+}
+
+// Bad literals in expressions: the parser must report the error of the
+// tokenizer, not one of its own. Checked once, before the first benchmark.
+void check_tokenizer_errors()
+{
+    static bool checked = false;
+    if (checked)
+        return;
+    for (const char* text :
+         {"x = \"abc\n", "x = 1 + \"a\\q\"\n", "x = 1 \x01\n"}) {
+        TokenizedExpression x;
+        tokenize(text, x);
+        CHECK(x.payloads.errors.size() == 1, "no tokenizer error", text);
+        const auto& expected = x.payloads.errors[0].msg;
+        TokenVectorStage stage(x.tokens);
+        TokenBatchSourceOf<TokenVectorStage> source(stage);
+        BufferedOutput output;
+        {
+            BufferedOutputScope bos(output);
+            auto parser = Parser::new_(source, x.payloads, "bench");
+            CHECK(!parser->parse_toplevel_loop());
+        }
+        CHECK(output.err.find(expected) != string::npos &&
+                  output.err.find("Expected") == string::npos,
+              "the parser reported", output.err, "instead of", expected);
+    }
+    checked = true;
+}
+
+void BM_parse_expression(benchmark::State& state, ExpressionShape shape)
+{
+    check_tokenizer_errors();
+    const int n = state.range(0);
+    const auto& x = tokenized_expression(shape, n);
+    for (auto _ : state) {
+        TokenVectorStage stage(x.tokens);
+        TokenBatchSourceOf<TokenVectorStage> source(stage);
+        auto parser = Parser::new_(source, x.payloads, "bench");
+        CHECK(parser->parse_toplevel_loop(), "parse error");
+    }
+    state.SetItemsProcessed(state.iterations() * x.tokens.size());
+    state.SetComplexityN(n);
+}
+}
+
+BENCHMARK_CAPTURE(BM_parse_expression, nested_parens, nested_parens)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18)
+    ->Complexity(benchmark::oN);
+BENCHMARK_CAPTURE(BM_parse_expression, right_nested, right_nested)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18)
+    ->Complexity(benchmark::oN);
+BENCHMARK_CAPTURE(BM_parse_expression, flat_chain, flat_chain)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18)
+    ->Complexity(benchmark::oN);
+BENCHMARK_CAPTURE(BM_parse_expression, prefix_chain, prefix_chain)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18)
+    ->Complexity(benchmark::oN);
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <random>
+
+#include "fmt/format.h"
+
+#include "benchmark/benchmark.h"
+
+#include "simdscan.h"
+
+using namespace maybe;
+
+// The scanning kernels of each instruction set on runs of chars of their
+// class. Before the first run every kernel is checked against the scalar
+// one on random buffers at random offsets.
+
+namespace {
+
+const char* const c_kernel_fn_names[] = {"identifier", "inline_wspace",
+                                         "comment", "literal"};
+const int c_num_kernel_fns = 4;
+
+ScanFn kernel_fn(const ScanKernels& k, int fn)
+{
+    const ScanFn fns[] = {k.identifier, k.inline_wspace, k.comment,
+                          k.literal};
+    return fns[fn];
+}
+
+// The chars in the class of the scalar kernel `fn`.
+string class_chars(ScanFn fn)
+{
+    string chars;
+    for (int c = 1; c < 256; ++c) {
+        const char s[c_scan_max_width + 1] = {(char)c};
+        if (fn(s) == s + 1)
+            chars += (char)c;
+    }
+    return chars;
+}
+
+// Runs of class chars (so the vector loops take several iterations) broken
+// by random bytes, NULs included, then the sentinel.
+string random_buffer(std::mt19937& rng, const string& chars, int size)
+{
+    string buf(size + c_scan_max_width, 0);
+    for (int i = 0; i < size; ++i)
+        buf[i] = rng() % 64 ? chars[rng() % chars.size()] : (char)rng();
+    return buf;
+}
+
+void check_kernels()
+{
+    static bool checked = false;
+    if (checked)
+        return;
+    const auto kernels = available_scan_kernels();
+    const auto& scalar = *kernels[0];
+    std::mt19937 rng(1);
+    for (int fn = 0; fn < c_num_kernel_fns; ++fn) {
+        const auto expected_fn = kernel_fn(scalar, fn);
+        const auto chars = class_chars(expected_fn);
+        for (int n = 0; n < 200; ++n) {
+            const auto buf = random_buffer(rng, chars, 1 + rng() % 4096);
+            const int size = buf.size() - c_scan_max_width;
+            for (int k = 0; k < 100; ++k) {
+                const char* p = buf.data() + rng() % (size + 1);
+                const char* expected = expected_fn(p);
+                for (auto x : kernels) {
+                    const char* r = kernel_fn(*x, fn)(p);
+                    CHECK(r == expected, x->name, c_kernel_fn_names[fn],
+                          "differs from scalar at offset", p - buf.data(),
+                          r - p, expected - p);
+                }
+            }
+        }
+    }
+    checked = true;
+}
+
+void kernel_args(benchmark::internal::Benchmark* b)
+{
+    const int num_kernels = available_scan_kernels().size();
+    for (int k = 0; k < num_kernels; ++k) {
+        for (int fn = 0; fn < c_num_kernel_fns; ++fn) {
+            for (int run : {8, 64, 1024})
+                b->Args({k, fn, run});
+        }
+    }
+}
+
+// A kernel scanning runs of `run` chars of its class, each followed by a
+// char out of it.
+void BM_scan(benchmark::State& state)
+{
+    check_kernels();
+    const auto kernels = available_scan_kernels();
+    const auto& k = *kernels[state.range(0)];
+    const int fn = state.range(1);
+    const int run = state.range(2);
+    state.SetLabel(fmt::format("{} {}", k.name, c_kernel_fn_names[fn]));
+    const auto scan = kernel_fn(k, fn);
+    const auto chars = class_chars(kernel_fn(*kernels[0], fn));
+    const int num_runs = std::max(1, (64 << 10) / (run + 1));
+    string buf;
+    std::mt19937 rng(1);
+    for (int i = 0; i < num_runs; ++i) {
+        for (int j = 0; j < run; ++j)
+            buf += chars[rng() % chars.size()];
+        buf += '\1';  // in none of the classes
+    }
+    buf.append(c_scan_max_width, 0);
+    for (auto _ : state) {
+        const char* p = buf.data();
+        for (int i = 0; i < num_runs; ++i)
+            p = scan(p) + 1;
+        benchmark::DoNotOptimize(p);
+    }
+    state.SetBytesProcessed(state.iterations() * num_runs * (run + 1));
+}
+}
+
+BENCHMARK(BM_scan)->Apply(kernel_args);
@@ -0,0 +1,69 @@
+#include <map>
+
+#include "benchmark/benchmark.h"
+
+#include "bench_source.h"
+#include "filereader.h"
+#include "tokenizer.h"
+
+using namespace maybe;
+
+namespace {
+
+// The TokenFifo implementation before the ring buffer, for comparison.
+struct DequeTokenFifo
+{
+    Token& front() { return tokens.front(); }
+    int size() const { return tokens.size(); }
+    void pop_front() { tokens.pop_front(); }
+    void push_back(const Token& t) { tokens.push_back(t); }
+    bool empty() const { return tokens.empty(); }
+
+private:
+    deque<Token> tokens;
+};
+
+// the tokens of the mixed corpus of `bytes` bytes
+const vector<Token>& bench_tokens(int bytes)
+{
+    static std::map<int, vector<Token>> cache;
+    auto& tokens = cache[bytes];
+    if (!tokens.empty())
+        return tokens;
+    auto filename = corpus_file(CorpusShape::mixed, bytes);
+    auto fr = FileReader::new_(filename);
+    CHECK(is_right(fr), "can't open", filename);
+    Tokenizer tokenizer(right(fr), filename);
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int n = tokenizer.fill(make_span(batch.data(), batch.size())))
+        tokens.insert(tokens.end(), batch.begin(), batch.begin() + n);
+    return tokens;
+}
+
+// Replays the tokens of the source through the FIFO the way the Tokenizer
+// uses it: reads a batch of tokens when the FIFO is empty then pops them one
+// by one.
+template <class Fifo>
+void BM_token_fifo(benchmark::State& state)
+{
+    const auto& tokens = bench_tokens(state.range(0));
+    for (auto _ : state) {
+        Fifo fifo;
+        int64_t sum = 0;
+        for (size_t next = 0; next < tokens.size() || !fifo.empty();) {
+            if (fifo.empty()) {
+                for (int i = 0;
+                     i < c_tokenizer_batch_size && next < tokens.size(); ++i)
+                    fifo.push_back(tokens[next++]);
+            }
+            sum += col(fifo.front());
+            fifo.pop_front();
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * tokens.size());
+}
+}
+
+BENCHMARK_TEMPLATE(BM_token_fifo, TokenFifo)->Arg(4 << 20);
+BENCHMARK_TEMPLATE(BM_token_fifo, DequeTokenFifo)->Arg(4 << 20);
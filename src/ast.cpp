@@ -0,0 +1,21 @@
+#include "ast.h"
+
+namespace maybe {
+
+void Ast::append(const Ast& other)
+{
+    const auto node_offset = (AstNodeId)nodes.size();
+    const auto child_offset = (uint32_t)child_ids.size();
+    nodes.reserve(nodes.size() + other.nodes.size());
+    for (auto node : other.nodes) {
+        node.children.begin += child_offset;
+        nodes.push_back(node);
+    }
+    child_ids.reserve(child_ids.size() + other.child_ids.size());
+    for (auto id : other.child_ids)
+        child_ids.push_back(id + node_offset);
+    toplevel.reserve(toplevel.size() + other.toplevel.size());
+    for (auto id : other.toplevel)
+        toplevel.push_back(id + node_offset);
+}
+}
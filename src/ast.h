@@ -0,0 +1,160 @@
+#pragma once
+
+#include "std.h"
+
+#include "symbols.h"
+#include "token.h"
+
+namespace maybe {
+
+// index of a node in Ast::nodes
+using AstNodeId = uint32_t;
+
+// A range of Ast::child_ids.
+struct AstRange
+{
+    uint32_t begin = 0, size = 0;
+};
+
+// A node of the flat AST. The nodes of a file live in one array and refer to
+// each other by index, the children of a node are a range of
+// Ast::child_ids. Names are Symbols. Like Token it's trivially copyable so
+// an Ast is built with a few allocations (the arrays growing) and freed
+// without visiting the nodes.
+struct AstNode
+{
+    enum Kind : uint8_t
+    {
+        // children: the args, the return type if has_return_type() and the
+        // body
+        function,
+        function_arg,  // children: the type, if any
+        identifier,
+        number,          // see literal_token()
+        string_literal,  // see literal_token()
+        prefix,          // children: the operand
+        binary,          // children: the left and the right operand
+        call,            // children: the callee and the args
+        index,           // children: the indexed value and the index
+        block,           // children: the statements
+        if_,             // children: the condition and the block
+        else_,           // children: the block
+        while_,          // children: the condition and the block
+        return_,         // children: the value, if any
+    };
+
+    static AstNode new_function(Symbol name,
+                                bool has_return_type,
+                                AstRange children)
+    {
+        return AstNode{function, has_return_type, name, children};
+    }
+    static AstNode new_function_arg(Symbol name, AstRange type)
+    {
+        assert(type.size <= 1);
+        return AstNode{function_arg, 0, name, type};
+    }
+    static AstNode new_identifier(Symbol name)
+    {
+        return AstNode{identifier, 0, name, {}};
+    }
+    // from a number or string_literal token, its payload stays in the
+    // TokenPayloads
+    static AstNode new_literal(const Token& t)
+    {
+        assert(t.kind == Token::number || t.kind == Token::string_literal);
+        return AstNode{t.kind == Token::number ? number : string_literal,
+                       t.sub, t.data, {}};
+    }
+    // prefix and binary
+    static AstNode new_operator(Kind kind, Symbol op, AstRange operands)
+    {
+        assert((kind == prefix && operands.size == 1) ||
+               (kind == binary && operands.size == 2));
+        return AstNode{kind, 0, op, operands};
+    }
+    // call, index, block, if_, else_, while_, return_
+    static AstNode new_(Kind kind, AstRange children)
+    {
+        return AstNode{kind, 0, 0, children};
+    }
+
+    Symbol name() const
+    {
+        assert(kind == function || kind == function_arg || kind == identifier);
+        return (Symbol)data;
+    }
+    Symbol operator_() const
+    {
+        assert(kind == prefix || kind == binary);
+        return (Symbol)data;
+    }
+    bool has_return_type() const
+    {
+        assert(kind == function);
+        return sub != 0;
+    }
+    // The token of a literal without its location, for
+    // TokenPayloads::number() and string_literal().
+    Token literal_token() const
+    {
+        assert(kind == number || kind == string_literal);
+        return Token{kind == number ? Token::number : Token::string_literal,
+                     sub, 0, 0, 0, data};
+    }
+
+    Kind kind;
+    // has_return_type (function), Token::sub (number, string_literal)
+    uint8_t sub;
+    // Symbol (function, function_arg, identifier, prefix, binary), Token::data
+    // (number, string_literal)
+    uint32_t data;
+    AstRange children;
+};
+
+static_assert(sizeof(AstNode) <= 16, "AstNode should fit in 16 bytes");
+static_assert(std::is_trivially_copyable<AstNode>::value,
+              "AstNode should be trivially copyable");
+
+// The AST of a file.
+struct Ast
+{
+    AstNodeId add_node(const AstNode& node)
+    {
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+    // Move the ids [begin, end) of `scratch` to child_ids, scratch is the
+    // stack of the children of the nodes being parsed.
+    AstRange add_children(vector<AstNodeId>& scratch, int begin)
+    {
+        assert(0 <= begin && begin <= (int)scratch.size());
+        const AstRange r{(uint32_t)child_ids.size(),
+                         (uint32_t)(scratch.size() - begin)};
+        child_ids.insert(child_ids.end(), scratch.begin() + begin,
+                         scratch.end());
+        scratch.resize(begin);
+        return r;
+    }
+
+    const AstNode& operator[](AstNodeId id) const { return nodes[id]; }
+    span<const AstNodeId> children(const AstNode& node) const
+    {
+        return make_span(child_ids.data() + node.children.begin,
+                         node.children.size);
+    }
+    // Append the nodes of `other` with their ids shifted, its top-level
+    // nodes follow ours. For merging the ASTs of the parts of a file.
+    void append(const Ast& other);
+    void clear()
+    {
+        nodes.clear();
+        child_ids.clear();
+        toplevel.clear();
+    }
+
+    vector<AstNode> nodes;
+    vector<AstNodeId> child_ids;  // the children ranges of the nodes
+    vector<AstNodeId> toplevel;   // the top-level nodes in source order
+};
+}
@@ -0,0 +1,324 @@
+#include "binaryformat.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "log.h"
+
+namespace maybe {
+
+static const array<uint32_t, c_num_binary_sections> c_record_sizes = {
+    {sizeof(Token), sizeof(AstNode), sizeof(AstNodeId), sizeof(AstNodeId),
+     sizeof(BinaryNumber), sizeof(BinaryString), sizeof(BinaryError),
+     sizeof(BinaryString), sizeof(char)}};
+
+// Builds the sections of a binary file.
+class BinaryWriter
+{
+public:
+    BinaryWriter(BinaryContents contents, string_par filename, bool ok)
+    {
+        header.magic = c_binary_magic;
+        header.version = c_binary_format_version;
+        header.contents = contents;
+        header.ok = ok;
+        header.num_sections = c_num_binary_sections;
+        // the sections not set are empty
+        for (int i = 0; i < c_num_binary_sections; ++i)
+            header.sections[i].record_size = c_record_sizes[i];
+        header.filename = add_chars(
+            make_span(filename.c_str(), strlen(filename.c_str())));
+    }
+
+    template <class T>
+    void set_section(BinarySection s, const T* records, size_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "");
+        assert(sizeof(T) == c_record_sizes[s]);
+        sections[s].assign((const char*)records, count * sizeof(T));
+        header.sections[s].count = count;
+        header.sections[s].record_size = sizeof(T);
+    }
+
+    BinaryString add_chars(cspan chars)
+    {
+        const BinaryString s{(uint32_t)this->chars.size(),
+                             (uint32_t)chars.size()};
+        this->chars.append(chars.data(), chars.size());
+        return s;
+    }
+
+    // The index of `s` in the symbols section of the file, the symbols are
+    // added in the order of their first use.
+    uint32_t symbol_index(Symbol s)
+    {
+        if (s >= symbol_indices.size())
+            symbol_indices.resize(s + 1, UINT32_MAX);
+        auto& ix = symbol_indices[s];
+        if (ix == UINT32_MAX) {
+            ix = symbols.size();
+            const auto& name = symbol_str(s);
+            symbols.push_back(add_chars(make_span(name.data(), name.size())));
+        }
+        return ix;
+    }
+
+    // The number and string literal tables of the tokens.
+    void set_literals(const TokenPayloads& payloads)
+    {
+        vector<BinaryNumber> numbers;
+        numbers.reserve(payloads.numbers.size());
+        for (auto& x : payloads.numbers) {
+            BinaryNumber n{};
+            n.is_real = holds_alternative<long double>(x);
+            if (n.is_real)
+                memcpy(n.value.data(), &get<long double>(x),
+                       sizeof(long double));
+            else
+                memcpy(n.value.data(), &get<uint64_t>(x), sizeof(uint64_t));
+            numbers.push_back(n);
+        }
+        set_section(bs_numbers, numbers.data(), numbers.size());
+        vector<BinaryString> strings;
+        strings.reserve(payloads.strings.size());
+        for (auto s : payloads.strings)
+            strings.push_back(add_chars(s));
+        set_section(bs_strings, strings.data(), strings.size());
+    }
+
+    void set_errors(const TokenPayloads& payloads)
+    {
+        vector<BinaryError> errors;
+        errors.reserve(payloads.errors.size());
+        for (auto& e : payloads.errors) {
+            errors.push_back(BinaryError{
+                add_chars(make_span(e.msg.data(), e.msg.size())), e.line_num,
+                e.col, e.length});
+        }
+        set_section(bs_errors, errors.data(), errors.size());
+    }
+
+    // The file: the header, then the sections in order, 8-byte aligned.
+    string finish()
+    {
+        set_section(bs_symbols, symbols.data(), symbols.size());
+        set_section(bs_chars, chars.data(), chars.size());
+        size_t size = sizeof(header);
+        for (int i = 0; i < c_num_binary_sections; ++i) {
+            size = (size + 7) & ~size_t(7);
+            header.sections[i].offset = size;
+            size += sections[i].size();
+        }
+        string bytes;
+        bytes.reserve(size);
+        bytes.append((const char*)&header, sizeof(header));
+        for (int i = 0; i < c_num_binary_sections; ++i) {
+            bytes.resize(header.sections[i].offset);
+            bytes += sections[i];
+        }
+        return bytes;
+    }
+
+private:
+    BinaryHeader header{};
+    array<string, c_num_binary_sections> sections;
+    string chars;
+    vector<BinaryString> symbols;
+    vector<uint32_t> symbol_indices;  // by Symbol, UINT32_MAX if not added
+};
+
+string tokens_to_binary(span<const Token> tokens,
+                        const TokenPayloads& payloads,
+                        string_par filename,
+                        bool ok)
+{
+    BinaryWriter w(BinaryContents::tokens, filename, ok);
+    vector<Token> records(tokens.begin(), tokens.end());
+    for (auto& t : records) {
+        if (t.kind == Token::word)
+            t.data = w.symbol_index(t.symbol());
+    }
+    w.set_section(bs_tokens, records.data(), records.size());
+    w.set_literals(payloads);
+    w.set_errors(payloads);
+    return w.finish();
+}
+
+string ast_to_binary(const Ast& ast,
+                     const TokenPayloads& payloads,
+                     string_par filename,
+                     bool ok)
+{
+    BinaryWriter w(BinaryContents::ast, filename, ok);
+    vector<AstNode> records = ast.nodes;
+    for (auto& n : records) {
+        switch (n.kind) {
+            case AstNode::function:
+            case AstNode::function_arg:
+            case AstNode::identifier:
+            case AstNode::prefix:
+            case AstNode::binary:
+                n.data = w.symbol_index((Symbol)n.data);
+                break;
+            default:
+                break;
+        }
+    }
+    w.set_section(bs_nodes, records.data(), records.size());
+    w.set_section(bs_child_ids, ast.child_ids.data(), ast.child_ids.size());
+    w.set_section(bs_toplevel, ast.toplevel.data(), ast.toplevel.size());
+    w.set_literals(payloads);
+    return w.finish();
+}
+
+bool write_binary_file(string_par path, const string& bytes)
+{
+    FILE* f = nowide::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return fclose(f) == 0 && ok;
+}
+
+BinaryFile::BinaryFile(const char* data,
+                       size_t size,
+                       uptr<char[]> owned,
+                       string path)
+    : data(data), size(size), owned(move(owned)), path(move(path))
+{
+}
+
+BinaryFile::BinaryFile(BinaryFile&& x)
+    : data(x.data), size(x.size), owned(move(x.owned)), path(move(x.path))
+{
+    x.data = nullptr;
+    x.size = 0;
+}
+
+BinaryFile::~BinaryFile()
+{
+#ifndef _WIN32
+    if (data && !owned) {
+        int r = munmap((void*)data, size);
+        if (r != 0)
+            LOG_DEBUG("munmap(\"{}\") -> {}", path, r);
+    }
+#endif
+}
+
+Either<string, BinaryFile> BinaryFile::load(string path)
+{
+    FILE* f = nowide::fopen(path.c_str(), "rb");
+    if (!f)
+        return fmt::format("can't open '{}'", path);
+    size_t size = 0;
+    const char* data = nullptr;
+    uptr<char[]> owned;
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size >= (off_t)sizeof(BinaryHeader)) {
+        size = st.st_size;
+        void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (m != MAP_FAILED)
+            data = (const char*)m;
+    }
+#endif
+    if (!data) {
+        string chars;
+        if (!read_all(f, chars)) {
+            fclose(f);
+            return fmt::format("can't read '{}'", path);
+        }
+        size = chars.size();
+        owned.reset(new char[std::max<size_t>(size, 1)]);
+        memcpy(owned.get(), chars.data(), size);
+        data = owned.get();
+    }
+    fclose(f);
+    BinaryFile file(data, size, move(owned), path);
+
+    if (size < sizeof(BinaryHeader) || file.header().magic != c_binary_magic)
+        return fmt::format("'{}' is not a binary file of {}", path,
+                           c_program_name);
+    const auto& h = file.header();
+    if (h.version != c_binary_format_version ||
+        h.num_sections != c_num_binary_sections)
+        return fmt::format("'{}' has version {} of the binary format, not {}",
+                           path, h.version, c_binary_format_version);
+    for (int i = 0; i < c_num_binary_sections; ++i) {
+        const auto& e = h.sections[i];
+        if (e.record_size != c_record_sizes[i] || e.offset % 8 != 0 ||
+            e.offset > size || (size - e.offset) / e.record_size < e.count)
+            return fmt::format("'{}' is corrupt or from another platform",
+                               path);
+    }
+    if (h.contents != BinaryContents::tokens &&
+        h.contents != BinaryContents::ast)
+        return fmt::format("'{}' is corrupt or from another platform", path);
+    return Either<string, BinaryFile>(move(file));
+}
+
+cspan BinaryFile::chars(BinaryString s) const
+{
+    const auto all = section<char>(bs_chars);
+    if (s.offset > all.size() || all.size() - s.offset < s.size)
+        return {};
+    return make_span(all.data() + s.offset, s.size);
+}
+
+cspan BinaryFile::symbol_name(uint32_t index) const
+{
+    const auto symbols = section<BinaryString>(bs_symbols);
+    return index < symbols.size() ? chars(symbols[index]) : cspan{};
+}
+
+Nonnegative BinaryFile::number(const Token& t) const
+{
+    assert(t.kind == Token::number);
+    if (!TokenPayloads::is_number_in_table(t))
+        return Nonnegative{uint64_t{t.data}};
+    const auto numbers = section<BinaryNumber>(bs_numbers);
+    if (t.data >= numbers.size())
+        return Nonnegative{uint64_t{0}};
+    const auto& n = numbers[t.data];
+    if (n.is_real) {
+        long double x;
+        memcpy(&x, n.value.data(), sizeof(x));
+        return Nonnegative{x};
+    }
+    uint64_t x;
+    memcpy(&x, n.value.data(), sizeof(x));
+    return Nonnegative{x};
+}
+
+cspan BinaryFile::raw_string_literal(const Token& t) const
+{
+    assert(t.kind == Token::string_literal);
+    const auto strings = section<BinaryString>(bs_strings);
+    return t.data < strings.size() ? chars(strings[t.data]) : cspan{};
+}
+
+ErrorInSourceFile BinaryFile::error(const Token& t) const
+{
+    assert(t.kind == Token::error);
+    const auto errors = section<BinaryError>(bs_errors);
+    ErrorInSourceFile e;
+    const auto name = filename();
+    e.filename.assign(name.data(), name.size());
+    if (t.aux >= errors.size())
+        return e;
+    const auto& be = errors[t.aux];
+    const auto msg = chars(be.msg);
+    e.msg.assign(msg.data(), msg.size());
+    e.line_num = be.line_num;
+    e.col = be.col;
+    e.length = be.length;
+    return e;
+}
+}
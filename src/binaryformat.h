@@ -0,0 +1,162 @@
+#pragma once
+
+#include "std.h"
+#include "utils.h"
+
+#include "ast.h"
+#include "token.h"
+
+namespace maybe {
+
+// Binary format of the tokens or the AST of a file, for caching and for the
+// tools working on the front end's results. A file is written in one piece
+// and read in place from a memory-mapped file, without parsing.
+//
+// A file is a BinaryHeader followed by its sections, each an array of
+// fixed-size records at an 8-byte aligned offset. The records are in the
+// native representation (like the FrontendCache entries), their sizes are
+// checked when loading. The Symbols of the tokens and the nodes are indices
+// into the symbols section, the names used in the file. The strings are
+// ranges of the chars section.
+
+static const array<char, 8> c_binary_magic = {
+    {'m', 'a', 'y', 'b', 'e', 'b', 'i', 'n'}};
+static const uint32_t c_binary_format_version = 1;
+
+enum class BinaryContents : uint32_t
+{
+    tokens,  // the tokens with their payloads
+    ast,     // the nodes with the payloads of the literals
+};
+
+enum BinarySection : uint32_t
+{
+    bs_tokens,     // Token
+    bs_nodes,      // AstNode
+    bs_child_ids,  // AstNodeId, see Ast::child_ids
+    bs_toplevel,   // AstNodeId, see Ast::toplevel
+    bs_numbers,    // BinaryNumber, see TokenPayloads::numbers
+    bs_strings,    // BinaryString, the raw string literals
+    bs_errors,     // BinaryError, the errors of the tokenizer
+    bs_symbols,    // BinaryString, the names of the symbols
+    bs_chars,      // char, the string table
+
+    c_num_binary_sections
+};
+
+// chars [offset, offset + size) of the chars section
+struct BinaryString
+{
+    uint32_t offset, size;
+};
+
+struct BinaryNumber
+{
+    uint32_t is_real;
+    uint32_t unused;
+    array<char, 16> value;  // the uint64_t or the long double
+};
+static_assert(sizeof(long double) <= 16, "long double doesn't fit");
+
+struct BinaryError
+{
+    BinaryString msg;
+    int32_t line_num, col, length;
+};
+
+struct BinarySectionEntry
+{
+    uint64_t offset;  // in the file
+    uint32_t count;   // of records
+    uint32_t record_size;
+};
+
+struct BinaryHeader
+{
+    array<char, 8> magic;
+    uint32_t version;
+    BinaryContents contents;
+    uint32_t ok;  // the front end succeeded
+    uint32_t num_sections;
+    BinaryString filename;
+    array<BinarySectionEntry, c_num_binary_sections> sections;
+};
+
+// The bytes of the binary file of the tokens of `filename` or of its AST.
+// `ok` is the result of the front end.
+string tokens_to_binary(span<const Token> tokens,
+                        const TokenPayloads& payloads,
+                        string_par filename,
+                        bool ok);
+string ast_to_binary(const Ast& ast,
+                     const TokenPayloads& payloads,
+                     string_par filename,
+                     bool ok);
+// Write `bytes` to the file `path` with a single write.
+bool write_binary_file(string_par path, const string& bytes);
+
+// A binary file mapped in memory. Only the header and the bounds of the
+// sections are checked when loading, the accessors return the records in
+// place and check the indices they follow.
+class BinaryFile
+{
+public:
+    // The error msg if the file can't be read or isn't a valid binary file
+    // of this version.
+    static Either<string, BinaryFile> load(string path);
+
+    BinaryFile(BinaryFile&& x);
+    ~BinaryFile();
+    BinaryFile(const BinaryFile&) = delete;
+    void operator=(const BinaryFile&) = delete;
+    void operator=(BinaryFile&&) = delete;
+
+    BinaryContents contents() const { return header().contents; }
+    bool ok() const { return header().ok != 0; }
+    cspan filename() const { return chars(header().filename); }
+
+    span<const Token> tokens() const { return section<Token>(bs_tokens); }
+    span<const AstNode> nodes() const { return section<AstNode>(bs_nodes); }
+    span<const AstNodeId> child_ids() const
+    {
+        return section<AstNodeId>(bs_child_ids);
+    }
+    span<const AstNodeId> toplevel() const
+    {
+        return section<AstNodeId>(bs_toplevel);
+    }
+
+    int num_symbols() const
+    {
+        return section<BinaryString>(bs_symbols).size();
+    }
+    // The name of the Symbol `index` of the file (of a word token or a
+    // node), empty if out of range.
+    cspan symbol_name(uint32_t index) const;
+    // The payloads of the tokens, like TokenPayloads. The literal nodes give
+    // their tokens by AstNode::literal_token().
+    Nonnegative number(const Token& t) const;
+    cspan raw_string_literal(const Token& t) const;
+    ErrorInSourceFile error(const Token& t) const;
+
+private:
+    BinaryFile(const char* data,
+               size_t size,
+               uptr<char[]> owned,
+               string path);
+
+    const BinaryHeader& header() const { return *(const BinaryHeader*)data; }
+    template <class T>
+    span<const T> section(BinarySection s) const
+    {
+        const auto& e = header().sections[s];
+        return make_span((const T*)(data + e.offset), e.count);
+    }
+    cspan chars(BinaryString s) const;
+
+    const char* data;
+    size_t size;
+    uptr<char[]> owned;  // the chars if the file isn't mapped
+    string path;
+};
+}
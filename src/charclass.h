@@ -0,0 +1,95 @@
+#pragma once
+
+#include "std.h"
+#include "consts.h"
+
+namespace maybe {
+
+// Character classes used by the tokenizer. A char may belong to more than
+// one class, all of them are answered by a single lookup in c_char_classes.
+enum CharClass : uint16_t
+{
+    cc_alpha = 1 << 0,  // [A-Za-z], starts an identifier
+    cc_digit = 1 << 1,  // [0-9]
+    cc_identifier = cc_alpha | cc_digit,
+    cc_operator = 1 << 2,       // c_token_operators
+    cc_separator = 1 << 3,      // c_token_separators
+    cc_inline_wspace = 1 << 4,  // SPACE, TAB
+    cc_newline = 1 << 5,        // CR, LF
+    cc_comment_start = 1 << 6,  // first char of a shell or inline comment
+    cc_ucnzc = 1 << 7,          // TODO use unicode chars, see is_ucnzc
+    // allowed in comments, TODO: instead of space, test for Zs, also allow
+    // Cf|Cs
+    cc_comment_char = 1 << 8,
+    // can be copied as it is into an interpreted string literal (no control
+    // char, quote or backslash)
+    cc_literal_char = 1 << 9,
+    cc_escape = 1 << 10,  // allowed after a backslash in a string literal
+    cc_hex_digit = 1 << 11,  // [0-9A-Fa-f]
+};
+
+using CharClassTable = array<uint16_t, 256>;
+
+constexpr void add_char_class(CharClassTable& t, const char* chars, uint16_t cc)
+{
+    for (; *chars; ++chars)
+        t[(uint8_t)*chars] |= cc;
+}
+
+constexpr CharClassTable make_char_class_table()
+{
+    CharClassTable t{};
+    for (int c = 0; c < 256; ++c) {
+        if (('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z'))
+            t[c] |= cc_alpha;
+        if ('0' <= c && c <= '9')
+            t[c] |= cc_digit | cc_hex_digit;
+        if (('A' <= c && c <= 'F') || ('a' <= c && c <= 'f'))
+            t[c] |= cc_hex_digit;
+        if (0x20 <= c) {
+            t[c] |= cc_ucnzc | cc_comment_char;
+            if (c != '"' && c != '\\')
+                t[c] |= cc_literal_char;
+        }
+    }
+    add_char_class(t, c_token_operators, cc_operator);
+    add_char_class(t, c_token_separators, cc_separator);
+    add_char_class(t, " \t", cc_inline_wspace | cc_comment_char);
+    add_char_class(t, "\r\n", cc_newline);
+    t[(uint8_t)c_token_shell_comment] |= cc_comment_start;
+    t[(uint8_t)c_lang_inline_comment[0]] |= cc_comment_start;
+    add_char_class(t, c_tokenizer_escape_sequences, cc_escape);
+    // listed for the resolution table but not accepted in interpreted
+    // (double-quoted) literals
+    t[(uint8_t)'\''] &= ~cc_escape;
+    return t;
+}
+
+constexpr CharClassTable c_char_classes = make_char_class_table();
+
+inline bool has_char_class(char c, uint16_t cc)
+{
+    return (c_char_classes[(uint8_t)c] & cc) != 0;
+}
+
+// valid for chars of cc_hex_digit
+inline int hex_digit_value(char c)
+{
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+using EscapeTable = array<char, 256>;
+
+// Char resolved from an escape sequence indexed by the char after the
+// backslash, valid for chars of cc_escape.
+constexpr EscapeTable make_escape_table()
+{
+    EscapeTable t{};
+    for (int i = 0; c_tokenizer_escape_sequences[i]; ++i)
+        t[(uint8_t)c_tokenizer_escape_sequences[i]] =
+            c_tokenizer_resolved_espace_sequences[i];
+    return t;
+}
+
+constexpr EscapeTable c_escape_table = make_escape_table();
+}
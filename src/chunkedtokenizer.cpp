@@ -0,0 +1,134 @@
+#include "chunkedtokenizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+#include "stats.h"
+
+namespace maybe {
+
+int ChunkedTokenizer::num_chunks(int size, int num_threads)
+{
+    return std::max(1,
+                    std::min(num_threads, size / c_tokenizer_min_chunk_size));
+}
+
+ChunkedTokenizer::ChunkedTokenizer(const FileReader& fr,
+                                   string filename,
+                                   int num_threads)
+    : fr(fr), filename(move(filename))
+{
+    // the time of the other threads is added by tokenize()
+    PhaseTimer timer(Phase::tokenize);
+    // split after the first LF from the evenly spaced split points
+    const auto file = fr.mapped_span();
+    const int begin = fr.cursor() - file.data();  // after the BOM
+    const int n = num_chunks(file.size() - begin, num_threads);
+    for (int b = begin;;) {
+        int e = file.size();
+        if ((int)chunks.size() + 1 < n) {
+            const int split = std::max<int>(
+                b, begin + (int64_t)(file.size() - begin) *
+                               (chunks.size() + 1) / n);
+            if (auto lf = (const char*)memchr(file.data() + split, c_ascii_LF,
+                                              file.size() - split))
+                e = lf + 1 - file.data();
+        }
+        chunks.emplace_back();
+        chunks.back().begin = b;
+        chunks.back().end = e;
+        if (e == file.size())
+            break;
+        b = e;
+    }
+
+    vector<std::exception_ptr> exceptions(chunks.size());
+    auto tokenize_chunk = [this, &exceptions](int i) {
+        try {
+            tokenize(chunks[i], Nothing);
+        } catch (...) {
+            exceptions[i] = std::current_exception();
+        }
+    };
+    vector<std::thread> threads;
+    threads.reserve(chunks.size() - 1);
+    for (int i = 1; i < (int)chunks.size(); ++i)
+        threads.emplace_back(tokenize_chunk, i);
+    tokenize_chunk(0);  // on this thread
+    for (auto& t : threads)
+        t.join();
+    for (auto& e : exceptions)
+        if (e)
+            std::rethrow_exception(e);
+
+    fix_up_chunks();
+}
+
+void ChunkedTokenizer::tokenize(Chunk& chunk, Maybe<char> indent_char)
+{
+    PhaseTimer timer(Phase::tokenize);
+    TraceSpan span(fmt::format("{} [{}, {})", filename, chunk.begin, chunk.end),
+                   "chunk");
+    auto part = fr.part_from(chunk.begin);
+    Tokenizer tokenizer(part, filename);
+    const auto file = fr.mapped_span();
+    if (chunk.end < file.size())
+        tokenizer.set_end_of_part(file.data() + chunk.end);
+    if (indent_char)
+        tokenizer.set_indent_char(*indent_char);
+    chunk.tokens.clear();
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int n = tokenizer.fill(make_span(batch.data(), batch.size())))
+        chunk.tokens.insert(chunk.tokens.end(), batch.begin(),
+                            batch.begin() + n);
+    chunk.payloads = move(tokenizer.payloads);
+    chunk.indent_char = tokenizer.indent_char();
+    chunk.complete = tokenizer.reached_end_of_part();
+}
+
+void ChunkedTokenizer::fix_up_chunks()
+{
+    // The indentation char of the file is the first one in the file, the
+    // chunks which found a different one first must be tokenized again.
+    // Retokenizing can't make a chunk complete so a chunk which stopped
+    // early ends the file.
+    Maybe<char> indent_char = chunks[0].indent_char;
+    for (int i = 1; i < (int)chunks.size(); ++i) {
+        if (!chunks[i - 1].complete) {
+            chunks.resize(i);
+            break;
+        }
+        auto& chunk = chunks[i];
+        if (indent_char && chunk.indent_char &&
+            *chunk.indent_char != *indent_char)
+            tokenize(chunk, indent_char);
+        if (!indent_char)
+            indent_char = chunk.indent_char;
+    }
+}
+
+int ChunkedTokenizer::fill(span<Token> out)
+{
+    int n = 0;
+    while (n < out.size() && next_chunk < (int)chunks.size()) {
+        auto& chunk = chunks[next_chunk];
+        const bool last_chunk = next_chunk + 1 == (int)chunks.size();
+        while (n < out.size() && next_token < chunk.tokens.size()) {
+            const Token& t = chunk.tokens[next_token++];
+            if (t.kind == Token::eof && !last_chunk) {
+                // the eof is at the first line of the next chunk
+                line_offset += t.line_num() - 1;
+                break;
+            }
+            out[n++] = payloads.add_token_from(chunk.payloads, t, line_offset);
+        }
+        if (next_token == chunk.tokens.size()) {
+            ++next_chunk;
+            next_token = 0;
+        }
+    }
+    return n;
+}
+}
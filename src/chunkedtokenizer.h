@@ -0,0 +1,57 @@
+#pragma once
+
+#include "std.h"
+
+#include "tokenizer.h"
+
+namespace maybe {
+
+// Tokenizes a mapped file in chunks on multiple threads. The language is
+// line-based (string literals and comments end at the end of the line) so
+// the file is split after LF chars and the chunks are tokenized
+// independently, each with a Tokenizer stopping at the end of its chunk.
+//
+// The fix-ups when the tokens are stitched together: the line numbers of
+// each chunk are shifted and the payloads are merged, the chunks which
+// guessed the indentation char of the file wrong are tokenized again and the
+// tokens after a chunk which stopped early (on an error) are dropped.
+//
+// A pipeline stage like the Tokenizer, it emits the indentation whitespace,
+// not the implicit tokens.
+class ChunkedTokenizer
+{
+public:
+    // `fr` must be mapped and outlive the ChunkedTokenizer, all the work is
+    // done here.
+    ChunkedTokenizer(const FileReader& fr, string filename, int num_threads);
+
+    // Number of chunks for a file of `size` chars.
+    static int num_chunks(int size, int num_threads);
+
+    int fill(span<Token> out);
+
+    // payloads of the tokens emitted so far
+    TokenPayloads payloads;
+
+private:
+    struct Chunk
+    {
+        int begin, end;  // offsets in the file
+        vector<Token> tokens;
+        TokenPayloads payloads;
+        Maybe<char> indent_char;
+        bool complete = false;  // reached the end of the chunk
+    };
+
+    void tokenize(Chunk& chunk, Maybe<char> indent_char);
+    void fix_up_chunks();
+
+    const FileReader& fr;
+    string filename;
+    vector<Chunk> chunks;
+    // position of fill()
+    int next_chunk = 0;
+    size_t next_token = 0;
+    int line_offset = 0;  // of chunks[next_chunk]
+};
+}
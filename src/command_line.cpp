@@ -1,4 +1,6 @@
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 
 #include "ul/string.h"
 #include "ul/ul.h"
@@ -22,8 +24,35 @@ CommandLine parse_command_line(int argc, const char* const argv[])
             a += 2;
             if (startswith(a, "help"))
                 cl.help = true;
+            else if (!strcmp(a, "dump-tokens"))
+                cl.dump_tokens = true;
+            else if (startswith(a, "cache-dir=") && a[10])
+                cl.cache_dir = a + 10;
+            else if (!strcmp(a, "stats"))
+                cl.stats = true;
+            else if (!strcmp(a, "time-report"))
+                cl.time_report = true;
+            else if (startswith(a, "trace=") && a[6])
+                cl.trace_file = a + 6;
+            else if (!strcmp(a, "emit=tokens-bin"))
+                cl.emit = Emit::tokens_bin;
+            else if (!strcmp(a, "emit=ast-bin"))
+                cl.emit = Emit::ast_bin;
             else
                 log_fatal("invalid option: '{}'", argv[i]);
+        } else if (startswith(a, "-j")) {
+            // -j N or -jN
+            a += 2;
+            if (!*a) {
+                if (++i >= argc)
+                    log_fatal("missing value after '-j'");
+                a = argv[i];
+            }
+            char* end = nullptr;
+            long n = strtol(a, &end, 10);
+            if (end == a || *end || n < 1 || n > c_max_jobs)
+                log_fatal("invalid number of jobs: '{}'", a);
+            cl.jobs = (int)n;
         } else {
             cl.files.emplace_back(a);
         }
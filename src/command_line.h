@@ -3,11 +3,26 @@
 #include "std.h"
 
 namespace maybe {
+// the binary results written for each file, see binaryformat.h
+enum class Emit
+{
+    none,
+    tokens_bin,
+    ast_bin,
+};
+
 struct CommandLine
 {
     bool help = false;
     vector<string> files;
     string out;
+    int jobs = 1;  // number of files compiled in parallel
+    bool dump_tokens = false;  // print the tokens passed to the parser
+    string cache_dir;          // of the front-end results, no caching if empty
+    bool stats = false;        // print the counters of the compilation
+    bool time_report = false;  // print the phase times and the counters
+    string trace_file;         // write the Chrome trace events here if set
+    Emit emit = Emit::none;
 };
 
 using ize = char const* const;
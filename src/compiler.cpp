@@ -1,150 +1,422 @@
 #include "compiler.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 #include "log.h"
 #include "filereader.h"
 #include "tokenizer.h"
 #include "parser.h"
 #include "tokenimplicitinserter.h"
+#include "chunkedtokenizer.h"
+#include "frontendcache.h"
+#include "binaryformat.h"
+#include "tokendump.h"
+#include "stats.h"
 
 namespace maybe {
 
-struct to_string_functor
+// Pipeline stage which dumps the tokens passing through it to `writer`, if
+// not null.
+template <class Source>
+class TokenStreamPrinter
 {
-    template <class T>
-    string operator()(const T& x) const
+public:
+    TokenStreamPrinter(Source& source, TokenDumpWriter* writer)
+        : source(source), writer(writer)
     {
-        return std::to_string(x);
     }
+    int fill(span<Token> out)
+    {
+        const int n = source.fill(out);
+        if (writer)
+            writer->write(make_span(out.data(), n));
+        return n;
+    }
+
+private:
+    Source& source;
+    TokenDumpWriter* writer;
 };
 
-class TokenStreamPrinter
+// Pipeline stage which counts the tokens passing through it by kind, see
+// Stats::tokens_by_kind.
+template <class Source>
+class TokenCounter
 {
 public:
-    TokenStreamPrinter(TokenSource&& token_source)
-        : token_source(move(token_source))
+    explicit TokenCounter(Source& source) : source(source) {}
+    ~TokenCounter()
     {
+        int64_t total = 0;
+        for (int i = 0; i < c_num_token_kinds; ++i) {
+            stats.tokens_by_kind[i].fetch_add(counts[i],
+                                              std::memory_order_relaxed);
+            total += counts[i];
+        }
+        stats.add(Counter::tokens, total);
     }
-    Token& get_next_token()
+    int fill(span<Token> out)
+    {
+        const int n = source.fill(out);
+        for (int i = 0; i < n; ++i)
+            ++counts[out[i].kind];
+        return n;
+    }
+
+private:
+    Source& source;
+    array<int64_t, c_num_token_kinds> counts = {};
+};
+
+// Pipeline stage which appends the tokens passing through it to `tokens`.
+template <class Source>
+class TokenRecorder
+{
+public:
+    TokenRecorder(Source& source, vector<Token>& tokens)
+        : source(source), tokens(tokens)
     {
-        auto& token = token_source();
-        BEGIN_VISIT_VARIANT_WITH(x)
-        IF_VISITED_VARIANT_IS(x, TokenWspace)
-        {
-            if (x.inline_()) {
-                printf(" ");
-            } else {
-                string s(x.indent_level, ' ');
-                printf("\n%04d%s", x.line_num, s.c_str());
-            }
-        }
-        else IF_VISITED_VARIANT_IS(x, TokenWord)
-        {
-            printf("<%s>", x.s.c_str());
-        }
-        else IF_VISITED_VARIANT_IS(x, TokenNumber)
-        {
-            printf("#%s", visit(to_string_functor{}, x.value).c_str());
-        }
-        else IF_VISITED_VARIANT_IS(x, TokenStringLiteral)
-        {
-            printf("\"");
-            for (auto c : x.s) {
-                if (isprint(c))
-                    printf("%c", c);
-                else
-                    printf("\\x%02x", c);
-            }
-            printf("\"");
-        }
-        else IF_VISITED_VARIANT_IS(x, ErrorInSourceFile)
-        {
-            if (x.has_location()) {
-                printf("ERROR in %s: %s:%d:%d:%d\n", x.filename.c_str(),
-                       x.msg.c_str(), x.line_num, x.col, x.length);
-            } else {
-                printf("ERROR in %s: %s\n", x.filename.c_str(), x.msg.c_str());
-            }
-        }
-        else IF_VISITED_VARIANT_IS(x, TokenEof) { printf("<EOF>\n"); }
-        else IF_VISITED_VARIANT_IS(x, TokenImplicit)
-        {
-            switch (x.kind) {
-                case TokenImplicit::sequencing:
-                    printf("\n$;");
-                    break;
-                case TokenImplicit::begin_block:
-                    printf("\n${");
-                    break;
-                case TokenImplicit::end_block:
-                    printf("\n$}");
-                    break;
-                default:
-                    CHECK(false);
-            }
-        }
-        else ERROR_VARIANT_VISIT_NOT_EXHAUSTIVE(x);
-        END_VISIT_VARIANT(token)
-        return token;
+    }
+    int fill(span<Token> out)
+    {
+        const int n = source.fill(out);
+        tokens.insert(tokens.end(), out.begin(), out.begin() + n);
+        return n;
     }
 
 private:
-    TokenSource token_source;
+    Source& source;
+    vector<Token>& tokens;
+};
+
+// Parse the tokens of the pipeline ending with `stage`, on `parser_threads`
+// threads if more than 1, and print them if `dump_tokens`. The tokens parsed
+// are appended to `recorded` and the syntax tree is copied to `ast` if not
+// null.
+template <class Stage>
+static bool parse_tokens(Stage& stage,
+                         const TokenPayloads& payloads,
+                         string_par filename,
+                         bool dump_tokens,
+                         vector<Token>* recorded,
+                         Ast* ast,
+                         int parser_threads)
+{
+    using Counted = TokenCounter<Stage>;
+    using Printer = TokenStreamPrinter<Counted>;
+    using TimedPrinter = TimedStage<Printer>;
+    using Recorder = TokenRecorder<TimedPrinter>;
+    Counted counted(stage);
+    uptr<TokenDumpWriter> dump;
+    if (dump_tokens)
+        dump = make_unique<TokenDumpWriter>(payloads);
+    Printer tsp(counted, dump.get());
+    TimedPrinter timed_tsp(tsp, Phase::print_tokens);
+    uptr<Recorder> recorder;
+
+    if (parser_threads > 1) {
+        // the parallel parser splits all the tokens up front
+        vector<Token> all_tokens;
+        auto& parsed = recorded ? *recorded : all_tokens;
+        Recorder r(timed_tsp, parsed);
+        array<Token, c_tokenizer_batch_size> batch;
+        while (r.fill(make_span(batch.data(), batch.size())) > 0) {
+        }
+        PhaseTimer timer(Phase::parse);
+        auto parser = Parser::new_parallel(parsed, payloads, filename.str(),
+                                           parser_threads);
+        const bool ok = parser->parse_toplevel_loop();
+        if (ast)
+            *ast = parser->syntax_tree();
+        return ok;
+    }
+
+    uptr<TokenBatchSource> tokens;
+    if (recorded) {
+        recorder = make_unique<Recorder>(timed_tsp, *recorded);
+        tokens = make_unique<TokenBatchSourceOf<Recorder>>(*recorder);
+    } else if (dump) {
+        tokens = make_unique<TokenBatchSourceOf<TimedPrinter>>(timed_tsp);
+    } else {
+        tokens = make_unique<TokenBatchSourceOf<Counted>>(counted);
+    }
+    PhaseTimer timer(Phase::parse);
+    auto parser = Parser::new_(*tokens, payloads, filename.str());
+    const bool ok = parser->parse_toplevel_loop();
+    if (ast)
+        *ast = parser->syntax_tree();
+    return ok;
+}
+
+// The tokens passed to the parser with their payloads, for --emit.
+struct ParsedTokens
+{
+    vector<Token> tokens;
+    TokenPayloads payloads;
 };
 
-// true on success
-bool compile_file(string_par filename)
+// Tokenize and parse, the files big enough to be tokenized in chunks are
+// parsed on `tokenizer_threads` threads, too. The tokens parsed and their
+// payloads are moved to `parsed` and the syntax tree to `ast` if not null.
+static bool compile(FileReader& fr,
+                    string_par filename,
+                    int tokenizer_threads,
+                    bool dump_tokens,
+                    ParsedTokens* parsed,
+                    Ast* ast)
 {
+    auto recorded = parsed ? &parsed->tokens : nullptr;
+    if (fr.is_mapped() &&
+        ChunkedTokenizer::num_chunks(fr.mapped_span().size(),
+                                     tokenizer_threads) > 1) {
+        using TimedTokenizer = TimedStage<ChunkedTokenizer>;
+        using Inserter = TokenImplicitInserter<TimedTokenizer>;
+        ChunkedTokenizer tokenizer{fr, filename.str(), tokenizer_threads};
+        TimedTokenizer timed_tokenizer(tokenizer, Phase::tokenize);
+        Inserter beti(timed_tokenizer);
+        TimedStage<Inserter> timed_beti(beti, Phase::implicit_tokens);
+        const bool ok =
+            parse_tokens(timed_beti, tokenizer.payloads, filename, dump_tokens,
+                         recorded, ast, tokenizer_threads);
+        stats.update_max(Counter::token_fifo_high_water,
+                         beti.fifo_high_water());
+        if (parsed)
+            parsed->payloads = move(tokenizer.payloads);
+        return ok;
+    }
+    Tokenizer tokenizer{fr, filename.str(), true};
+    TimedStage<Tokenizer> timed_tokenizer(tokenizer, Phase::tokenize);
+    const bool ok = parse_tokens(timed_tokenizer, tokenizer.payloads,
+                                 filename, dump_tokens, recorded, ast, 1);
+    stats.update_max(Counter::token_fifo_high_water,
+                     tokenizer.fifo.high_water());
+    if (parsed)
+        parsed->payloads = move(tokenizer.payloads);
+    return ok;
+}
+
+// Write the tokens or the syntax tree of the file to the binary file next to
+// the source, see binaryformat.h. `ok` is the result of the front end.
+static bool emit_binary(const CommandLine& cl,
+                        string_par filename,
+                        bool ok,
+                        const ParsedTokens& parsed,
+                        const Ast& ast)
+{
+    PhaseTimer timer(Phase::emit);
+    const bool tokens = cl.emit == Emit::tokens_bin;
+    const string name = !strcmp(filename.c_str(), c_stdin_display_name)
+                            ? string("stdin")
+                            : filename.str();
+    const string path = name + (tokens ? ".tokens.bin" : ".ast.bin");
+    const string bytes =
+        tokens ? tokens_to_binary(make_span(parsed.tokens.data(),
+                                            parsed.tokens.size()),
+                                  parsed.payloads, filename, ok)
+               : ast_to_binary(ast, parsed.payloads, filename, ok);
+    if (!write_binary_file(path, bytes)) {
+        report_error("can't write '{}'", path);
+        return false;
+    }
+    return true;
+}
+
+// Run the front end or replay its results from the cache. The mapped
+// sources are cached, the key is the hash of their chars.
+static bool compile_source(const CommandLine& cl,
+                           FileReader& fr,
+                           string_par filename,
+                           int tokenizer_threads)
+{
+    // the buffered reads are counted by FileReader::refill()
+    if (fr.is_mapped())
+        stats.add(Counter::bytes_read, fr.mapped_span().size());
+    if (cl.emit != Emit::none) {
+        // the cache entries have no syntax trees
+        ParsedTokens parsed;
+        Ast ast;
+        const bool ok = compile(fr, filename, tokenizer_threads,
+                                cl.dump_tokens, &parsed, &ast);
+        return emit_binary(cl, filename, ok, parsed, ast) && ok;
+    }
+    if (cl.cache_dir.empty() || !fr.is_mapped())
+        return compile(fr, filename, tokenizer_threads, cl.dump_tokens,
+                       nullptr, nullptr);
+    FrontendCache cache(cl.cache_dir);
+    // the chars are cut at invalid UTF-8, the output has the token dump
+    const uint64_t options =
+        (fr.has_invalid_utf8() ? 2 : 0) | (cl.dump_tokens ? 4 : 0);
+    Maybe<FrontendResult> cached;
+    uint64_t key;
+    {
+        PhaseTimer timer(Phase::cache);
+        key = FrontendCache::key(fr.mapped_span(), filename, options);
+        cached = cache.load(key);
+    }
+    if (cached) {
+        stats.add(Counter::cache_hits);
+        write_stdout(cached->output.out);
+        write_stderr(cached->output.err);
+        return cached->ok;
+    }
+    stats.add(Counter::cache_misses);
+    FrontendResult result;
+    {
+        BufferedOutputScope bos(result.output);
+        result.ok = compile(fr, filename, tokenizer_threads, cl.dump_tokens,
+                            nullptr, nullptr);
+    }
+    write_stdout(result.output.out);
+    write_stderr(result.output.err);
+    PhaseTimer timer(Phase::cache);
+    if (!cache.store(key, result)) {
+        stats.add(Counter::cache_write_errors);
+        LOG_DEBUG("can't write the cache entry of '{}'", filename.c_str());
+    }
+    return result.ok;
+}
+
+static bool compile_stdin(const CommandLine& cl)
+{
+    if (!cl.cache_dir.empty() || cl.emit != Emit::none) {
+        // the cache hashes the chars first, the binary files refer to them
+        string chars;
+        if (!read_all(stdin, chars)) {
+            report_error("can't read {}", c_stdin_display_name);
+            return false;
+        }
+        auto fr = FileReader::from_chars(make_span(chars.data(), chars.size()),
+                                         c_stdin_display_name);
+        return compile_source(cl, fr, c_stdin_display_name, cl.jobs);
+    }
+    auto fr = FileReader::from_stdin(c_stdin_display_name);
+    return compile(fr, c_stdin_display_name, 1, cl.dump_tokens, nullptr,
+                   nullptr);
+}
+
+bool compile_file(const CommandLine& cl,
+                  string_par filename,
+                  int tokenizer_threads)
+{
+    stats.add(Counter::files);
+    TraceSpan span(filename.str(), "file");
+    if (!strcmp(filename.c_str(), c_stdin_filename))
+        return compile_stdin(cl);
     auto lr = FileReader::new_(filename.c_str());
     if (is_left(lr)) {
         report_error(left(lr), "can't open file '{}'", filename.c_str());
         return false;
     }
-    auto fr = move(right(lr));
-    // skip UTF-8 BOM
+    return compile_source(cl, right(lr), filename, tokenizer_threads);
+}
+
+bool compile_buffer(const CommandLine& cl,
+                    string_par name,
+                    cspan chars,
+                    bool padded)
+{
+    stats.add(Counter::files);
+    TraceSpan span(name.str(), "file");
+    auto fr = padded ? FileReader::from_padded_chars(chars, name.str())
+                     : FileReader::from_chars(chars, name.str());
+    return compile_source(cl, fr, name, cl.jobs);
+}
+
+// Compile the files on cl.jobs worker threads. The output of each file is
+// buffered and emitted in input order as soon as the file and all the files
+// before it are done.
+static bool compile_files_in_parallel(const CommandLine& cl)
+{
+    struct Job
     {
-        static const array<char, 3> c_utf8_bom = {
-            {(char)0xef, (char)0xbb, (char)0xbf}};
-        fr.read_ahead_at_least(c_utf8_bom.size());
-        bool bom_failed = false;
-        for (int i = 0; i < c_utf8_bom.size(); ++i) {
-            auto c = fr.peek_char_in_read_buf(i);
-            if (!c || *c != c_utf8_bom[i]) {
-                bom_failed = true;
-                break;
+        BufferedOutput output;
+        bool ok = false;
+        bool done = false;
+        std::exception_ptr exception;
+    };
+    const int num_files = cl.files.size();
+    vector<Job> jobs(num_files);
+    std::mutex mutex;
+    std::condition_variable job_done;
+    std::atomic<int> next_job{0};
+
+    auto worker = [&]() {
+        for (;;) {
+            int i = next_job++;
+            if (i >= num_files)
+                return;
+            auto& job = jobs[i];
+            try {
+                BufferedOutputScope bos(job.output);
+                job.ok = compile_file(cl, cl.files[i], 1);
+            } catch (...) {
+                job.exception = std::current_exception();
             }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job.done = true;
+            }
+            job_done.notify_all();
         }
-        if (!bom_failed) {
-            for (int i = 0; i < c_utf8_bom.size(); ++i)
-                fr.next_char();
-        }
-    }
-    Tokenizer tokenizer{fr, filename.str()};
-
-    TokenSource ts1, ts2;
-    uptr<TokenStreamPrinter> tsp;
-    uptr<Parser> parser;
-    TokenImplicitInserter beti(
-        [&tokenizer]() -> Token& { return tokenizer.get_next_token(); });
-    TokenSource&& tokens_from_tokenizer = [&beti]() -> Token& {
-        return beti.get_next_token();
     };
-    if (false) {
-        parser = Parser::new_(move(tokens_from_tokenizer), filename.str());
-    } else {
-        tsp = make_unique<TokenStreamPrinter>(move(tokens_from_tokenizer));
-        parser =
-            Parser::new_([&tsp]() -> Token& { return tsp->get_next_token(); },
-                         filename.str());
+
+    vector<std::thread> threads;
+    const int num_threads = std::min(cl.jobs, num_files);
+    threads.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i)
+        threads.emplace_back(worker);
+
+    bool ok = true;
+    std::exception_ptr exception;
+    for (auto& job : jobs) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_done.wait(lock, [&job]() { return job.done; });
+        }
+        write_stdout(job.output.out);
+        write_stderr(job.output.err);
+        job.output = BufferedOutput{};
+        if (job.exception && !exception)
+            exception = job.exception;
+        if (!job.ok)
+            ok = false;
     }
-    return parser->parse_toplevel_loop();
+    for (auto& t : threads)
+        t.join();
+    if (exception)
+        std::rethrow_exception(exception);
+    return ok;
 }
 
 int run_compiler(const CommandLine& cl)
 {
+    globals.time_phases = cl.time_report;
+    globals.trace = !cl.trace_file.empty();
     bool ok = true;
-    for (auto& f : cl.files)
-        if (!compile_file(f))
-            ok = false;
+    {
+        TraceSpan span(c_program_name, "run");
+        if (cl.jobs > 1 && cl.files.size() > 1) {
+            ok = compile_files_in_parallel(cl);
+        } else {
+            // with -j a single file is tokenized on multiple threads
+            for (auto& f : cl.files)
+                if (!compile_file(cl, f, cl.jobs))
+                    ok = false;
+        }
+    }
+    if (cl.time_report)
+        print_time_report();
+    else if (cl.stats)
+        print_stats();
+    if (globals.trace && !write_trace(cl.trace_file)) {
+        report_error("can't write the trace file '{}'", cl.trace_file);
+        ok = false;
+    }
     return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 }
@@ -1,8 +1,25 @@
 #pragma once
 
+#include "std.h"
+#include "utils.h"
+
 #include "command_line.h"
 
 namespace maybe {
 // return result code for main
 int run_compiler(const CommandLine& cl);
+
+// Compile a source file with the options of `cl`, c_stdin_filename is the
+// standard input. With tokenizer_threads > 1 a large file is tokenized on
+// multiple threads. True on success.
+bool compile_file(const CommandLine& cl,
+                  string_par filename,
+                  int tokenizer_threads);
+// Compile source chars in memory, `name` is for the msgs. The chars are
+// copied unless `padded`: followed by c_filereader_lookahead NUL chars, see
+// FileReader::from_padded_chars().
+bool compile_buffer(const CommandLine& cl,
+                    string_par name,
+                    cspan chars,
+                    bool padded = false);
 }
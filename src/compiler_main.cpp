@@ -17,7 +17,28 @@ static const char* const c_usage_text =
     R"~~~~({0} compiler
 
 Usage: {0} --help
-       {0} <input-files>
+       {0} [-j <jobs>] [--dump-tokens] [--cache-dir=<dir>] [--stats]
+           [--time-report] [--trace=<file>] [--emit=tokens-bin|ast-bin]
+           <input-files>
+
+An input file '-' is the standard input.
+
+Options:
+    -j <jobs>                compile <jobs> files in parallel, or tokenize and
+                             parse a single large file on <jobs> threads
+    --dump-tokens            print the tokens passed to the parser
+    --cache-dir=<dir>        cache the front-end results of the files in
+                             <dir>, keyed by the hash of their contents
+    --stats                  print the counters of the compilation (bytes,
+                             tokens, errors, cache hits and misses, ...)
+    --time-report            print the wall and CPU time of the phases of
+                             the front end and the counters
+    --trace=<file>           write the spans of the files (and chunks) to
+                             <file> in the Chrome trace event format
+    --emit=tokens-bin        write the tokens of each input file to
+                             <input-file>.tokens.bin in the binary format
+    --emit=ast-bin           write the AST of each input file to
+                             <input-file>.ast.bin in the binary format
 )~~~~";
 
 int main(int argc, char* argv[])
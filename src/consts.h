@@ -1,27 +1,47 @@
 #pragma once
 
+#include "symbols.h"
+
 namespace maybe {
 
 static const char* const c_program_name = "maybe";
+static const char* const c_compiler_version = "0.1";
+static const char* const c_stdin_filename = "-";  // input file arg
+static const char* const c_stdin_display_name = "<stdin>";  // in msgs
 
 // things to tune
 static const int c_filereader_read_buf_capacity =
     65000;  // chars read together in one batch from the source files
+static const int c_filereader_lookahead =
+    32;  // guaranteed lookahead window and size of the NUL sentinel
 static const int c_tokenizer_batch_size =
-    10;  // number of tokens read in one batch
+    64;  // number of tokens passed in one batch between the pipeline stages
+static const int c_token_fifo_initial_capacity =
+    16;  // power of two, more than the tokens read at once
 static const int c_begin_end_token_inserter_initial_stack_capacity = 10;
+static const int c_max_jobs = 256;  // upper limit for -j
+static const int c_tokenizer_min_chunk_size =
+    1 << 20;  // smallest part of a file tokenized on its own thread
+static const int c_parser_min_chunk_tokens =
+    1 << 16;  // fewest tokens parsed on their own thread
+static const int c_parser_max_errors =
+    1000;  // reported for a file, then the parser stops
+static const int c_token_dump_block_size =
+    1 << 16;  // chars of the token dump written together
+static const int c_frontend_cache_format =
+    3;  // bump when the cache entries or the front-end results change
 
 // tokenizer/parser
-const char c_token_shell_comment = '#';
-static const char c_token_separators[] = "`\"'()[]{};:,";
-static const char c_token_operators[] = "~!@#$%^&*-=_+\\|./<>?";
-static const char c_tokenizer_escape_sequences[] = "abfnrv\\'\"0";
-static const char c_tokenizer_resolved_espace_sequences[] = {
+constexpr char c_token_shell_comment = '#';
+static constexpr char c_token_separators[] = "`\"'()[]{};:,";
+static constexpr char c_token_operators[] = "~!@#$%^&*-=_+\\|./<>?";
+static constexpr char c_tokenizer_escape_sequences[] = "abfnrv\\'\"0";
+static constexpr char c_tokenizer_resolved_espace_sequences[] = {
     7, 8, 12, 10, 13, 9, 11, 0x5c, 0x27, 0x22, 0};
 
 // language syntax
 const constexpr array<char, 2> c_lang_inline_comment = {{'/', '/'}};
-static const char* c_lang_separator_between_varname_and_type = ":";
+constexpr Symbol c_lang_separator_between_varname_and_type = sym_colon;
 
 static_assert(sizeof(c_tokenizer_escape_sequences) ==
                   sizeof(c_tokenizer_resolved_espace_sequences),
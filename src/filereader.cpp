@@ -1,65 +1,259 @@
 #include "filereader.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "log.h"
+#include "stats.h"
 #include "ul/check.h"
 
 namespace maybe {
 
+// source of the sentinel for empty files
+static const array<char, c_filereader_lookahead> c_empty_file = {};
+
+#ifndef _WIN32
+// Map `size` bytes of the file followed by at least c_filereader_lookahead
+// zero bytes. The tail of the file's last page is zero-filled by mmap, the
+// rest of the sentinel comes from an anonymous mapping right after it. The
+// pages are private and writable so the chars can be cut by moving the
+// sentinel (which copies a single page).
+static void* map_with_sentinel(int fd, int size, int& mapping_size)
+{
+    const long page_size = sysconf(_SC_PAGESIZE);
+    mapping_size =
+        ((size + c_filereader_lookahead + page_size - 1) / page_size) *
+        page_size;
+    void* m = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+        return nullptr;
+    if (mmap(m, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+             0) == MAP_FAILED) {
+        munmap(m, mapping_size);
+        return nullptr;
+    }
+    madvise(m, size, MADV_SEQUENTIAL);
+    return m;
+}
+#endif
+
 Either<system_error, FileReader> FileReader::new_(string filename)
 {
+    auto r = open(move(filename));
+    if (is_right(r))
+        right(r).advance_if_prefix(c_utf8_bom.data(), c_utf8_bom.size());
+    return r;
+}
+
+Either<system_error, FileReader> FileReader::open(string filename)
+{
+    // the pages of a mapped file are read later, in the phase touching them
+    PhaseTimer timer(Phase::read);
     FILE* f = nowide::fopen(filename.c_str(), "rb");
-    if (f)
-        return FileReader(f, move(filename));
-    else
+    if (!f)
         return system_error(errno, system_category());
+#ifndef _WIN32
+    // TODO: map files on Windows, too (CreateFileMapping)
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size <= INT_MAX - c_filereader_lookahead) {
+        int size = (int)st.st_size;
+        int mapping_size = 0;
+        void* m = nullptr;
+        if (size > 0)
+            m = map_with_sentinel(fileno(f), size, mapping_size);
+        if (m || size == 0) {
+            // the mapping stays valid after closing the file
+            fclose(f);
+            return FileReader((const char*)m, mapping_size, size,
+                              move(filename));
+        }
+        // fall back to reading
+    }
+#endif
+    return FileReader(f, move(filename));
 }
 
 FileReader::~FileReader()
 {
-    if (f) {
+    if (f && f != stdin) {
         int r = fclose(f);
         if (r != 0)
             LOG_DEBUG("fclose(\"{}\") -> {}", filename, r);
     }
+#ifndef _WIN32
+    if (mapping) {
+        int r = munmap((void*)mapping, mapping_size);
+        if (r != 0)
+            LOG_DEBUG("munmap(\"{}\") -> {}", filename, r);
+    }
+#endif
 }
 
 FileReader::FileReader(FILE* f, string filename)
     : read_buf(new ReadBuf), f(f), filename(move(filename))
 {
-    p.next_char_to_read = p.read_buf_end = &read_buf->front();
+    char* data = &read_buf->front() + c_filereader_lookahead;
+    *data = 0;
+    p.read_buf_begin = p.next_char_to_read = p.read_buf_end = p.refill_at =
+        data;
 }
 
-bool FileReader::advance_if_prefix(const char* q, int size)
+FileReader::FileReader(const char* mapping,
+                       int mapping_size,
+                       int size,
+                       string filename)
+    : mapping(mapping), mapping_size(mapping_size), filename(move(filename))
 {
-    const auto bytes_in_buf = p.read_buf_end - p.next_char_to_read;
-    if (bytes_in_buf < size || strncmp(q, p.next_char_to_read, size) != 0)
+    const char* b = mapping ? mapping : &c_empty_file.front();
+    set_chars(b, b + size);
+    validate_utf8(b, true);
+}
+
+FileReader FileReader::from_chars(cspan chars, string filename)
+{
+    const int size = chars.size();
+    FileReader r(nullptr, 0, 0, move(filename));
+    r.owned_chars.reset(new char[size + c_filereader_lookahead]);
+    char* data = r.owned_chars.get();
+    memcpy(data, chars.data(), size);
+    memset(data + size, 0, c_filereader_lookahead);
+    r.set_chars(data, data + size);
+    r.validate_utf8(data, true);
+    r.advance_if_prefix(c_utf8_bom.data(), c_utf8_bom.size());
+    return r;
+}
+
+FileReader FileReader::from_padded_chars(cspan chars, string filename)
+{
+    const char* e = chars.data() + chars.size();
+    assert(std::all_of(e, e + c_filereader_lookahead,
+                       [](char c) { return c == 0; }));
+    Utf8Validator utf8;
+    if (utf8.feed(chars.data(), e) || utf8.incomplete())
+        return from_chars(chars, move(filename));
+    return from_valid_padded_chars(chars, move(filename));
+}
+
+FileReader FileReader::from_valid_padded_chars(cspan chars, string filename)
+{
+    const char* e = chars.data() + chars.size();
+    assert(std::all_of(e, e + c_filereader_lookahead,
+                       [](char c) { return c == 0; }));
+    FileReader r(nullptr, 0, 0, move(filename));
+    r.set_chars(chars.data(), e);
+    r.advance_if_prefix(c_utf8_bom.data(), c_utf8_bom.size());
+    return r;
+}
+
+FileReader FileReader::from_stdin(string filename)
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    FileReader r(stdin, move(filename));
+    r.advance_if_prefix(c_utf8_bom.data(), c_utf8_bom.size());
+    return r;
+}
+
+void FileReader::set_chars(const char* b, const char* e)
+{
+    p.read_buf_begin = p.next_char_to_read = b;
+    p.read_buf_end = e;
+    p.refill_at = e + c_filereader_lookahead;
+}
+
+FileReader FileReader::part_from(int offset) const
+{
+    assert(is_mapped() && 0 <= offset &&
+           offset <= p.read_buf_end - p.read_buf_begin);
+    FileReader r(nullptr, 0, 0, filename);
+    r.set_chars(p.read_buf_begin + offset, p.read_buf_end);
+    r.utf8 = utf8;
+    r.invalid_utf8 = invalid_utf8;
+    return r;
+}
+
+void FileReader::validate_utf8(const char* b, bool at_eof)
+{
+    const char* bad = utf8.feed(b, p.read_buf_end);
+    if (!bad && at_eof && utf8.incomplete())
+        bad = p.read_buf_end;
+    if (!bad)
+        return;
+    // cut at the beginning of the invalid sequence unless it's been read
+    if (bad - p.next_char_to_read >= utf8.sequence_bytes_seen())
+        bad -= utf8.sequence_bytes_seen();
+    else
+        bad = p.next_char_to_read;
+    p.read_buf_end = bad;
+    memset((char*)p.read_buf_end, 0, c_filereader_lookahead);
+    p.refill_at = p.read_buf_end + c_filereader_lookahead;
+    invalid_utf8 = true;
+}
+
+bool FileReader::refill()
+{
+    if (!f || invalid_utf8)
         return false;
-    p.next_char_to_read += size;
-    return true;
+    if (feof(f) || ferror(f)) {
+        validate_utf8(p.read_buf_end, true);  // sequence cut by the eof?
+        return false;
+    }
+    // move the unread tail right before the place of the new batch
+    const auto tail = p.read_buf_end - p.next_char_to_read;
+    CHECK(tail < c_filereader_lookahead);
+    char* data = &read_buf->front() + c_filereader_lookahead;
+    char* dest = data - tail;
+    memmove(dest, p.next_char_to_read, tail);
+    p.read_buf_begin = p.next_char_to_read = dest;
+    size_t bytes_read;
+    {
+        PhaseTimer timer(Phase::read);
+        bytes_read = fread(data, 1, c_filereader_read_buf_capacity, f);
+    }
+    stats.add(Counter::refills);
+    stats.add(Counter::bytes_read, bytes_read);
+    p.read_buf_end = data + bytes_read;
+    memset((char*)p.read_buf_end, 0, c_filereader_lookahead);
+    p.refill_at = bytes_read > 0 ? p.read_buf_end
+                                 : p.read_buf_end + c_filereader_lookahead;
+    validate_utf8(data, bytes_read == 0);
+    return p.read_buf_end > data;
 }
 
-int FileReader::read_ahead_at_least(int n)
+void FileReader::fill_lookahead_window()
 {
-    CHECK(n <= c_filereader_read_buf_capacity);
-    const auto bytes_in_buf = p.read_buf_end - p.next_char_to_read;
-    if (bytes_in_buf >= n)
-        return bytes_in_buf;
-    if (bytes_in_buf > 0 && p.next_char_to_read > &read_buf->front()) {
-        // move unread slice of read_buf down to &read_buf->front()
-        std::copy(p.next_char_to_read, p.read_buf_end, &read_buf->front());
-        p.next_char_to_read -= &read_buf->front();
-        p.read_buf_end -= p.next_char_to_read - &read_buf->front();
+    while (p.read_buf_end - p.next_char_to_read < c_filereader_lookahead &&
+           refill()) {
     }
-    auto bytes_read = fread((void*)p.read_buf_end, 1,
-                            c_filereader_read_buf_capacity - bytes_in_buf, f);
-    p.read_buf_end += bytes_read;
-    return p.read_buf_end - p.next_char_to_read;
+    p.refill_at =
+        p.next_char_to_read + c_filereader_lookahead <= p.read_buf_end
+            ? p.read_buf_end
+            : p.read_buf_end + c_filereader_lookahead;  // eof
 }
 
-Maybe<char> FileReader::peek_char_in_read_buf(int i)
+bool FileReader::advance_if_prefix(const char* q, int size)
 {
-    if (p.read_buf_end - p.next_char_to_read >= i)
-        return (p.next_char_to_read)[i];
-    else
-        return Nothing;
+    assert(size <= c_filereader_lookahead);
+    if (UL_UNLIKELY(p.next_char_to_read + size > p.refill_at))
+        fill_lookahead_window();
+    if (p.read_buf_end - p.next_char_to_read < size ||
+        memcmp(q, p.next_char_to_read, size) != 0)
+        return false;
+    p.next_char_to_read += size;
+    p.chars_read += size;
+    return true;
 }
 }
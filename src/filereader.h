@@ -3,74 +3,150 @@
 #include "std.h"
 #include "utils.h"
 #include "consts.h"
+#include "utf8.h"
 
 namespace maybe {
 
+// Reads a source file either by memory-mapping it or through a buffer. Chars
+// in memory are read like a mapped file, the standard input through the
+// buffer.
+//
+// In both modes the unread chars [cursor(), buf_end()) are followed by
+// c_filereader_lookahead NUL chars so scanning loops can stop on the sentinel
+// instead of checking the end of the buffer for every char. Also, after
+// peek(i) or advance_if_prefix() the next c_filereader_lookahead chars are
+// available in one piece (or the sentinel if the file ends earlier).
+//
+// The contents are validated as UTF-8 when loaded (the whole file at open if
+// mapped, each batch otherwise). The chars end before the first invalid
+// sequence as if the file ended there, see has_invalid_utf8(). A BOM at the
+// beginning is skipped.
 class FileReader
 {
 public:
+    // Regular files are memory-mapped and exposed as one contiguous span,
+    // everything else (pipes, devices) is read through the buffered fread
+    // loop.
     static Either<system_error, FileReader> new_(string filename);
+    // Reads a copy of `chars` (e.g. an editor buffer) like a mapped file.
+    static FileReader from_chars(cspan chars, string filename);
+    // Reads `chars` in place like a mapped file, without copying. They must
+    // be followed by c_filereader_lookahead NUL chars and outlive the
+    // FileReader. If they're not valid UTF-8 they're copied (cutting them
+    // writes the sentinel).
+    static FileReader from_padded_chars(cspan chars, string filename);
+    // Like from_padded_chars() for chars known to be valid UTF-8 (e.g. an
+    // edited text validated around the edits), without validating them.
+    static FileReader from_valid_padded_chars(cspan chars, string filename);
+    // Reads the standard input through the buffer.
+    static FileReader from_stdin(string filename);
 
     // fow now, only move ctor allowed (add move assignment if needed)
     FileReader(const FileReader&) = delete;
     FileReader(FileReader&& x)
-        : p(x.p), read_buf(move(x.read_buf)), f(x.f), filename(move(x.filename))
+        : p(x.p),
+          read_buf(move(x.read_buf)),
+          owned_chars(move(x.owned_chars)),
+          f(x.f),
+          mapping(x.mapping),
+          mapping_size(x.mapping_size),
+          utf8(x.utf8),
+          invalid_utf8(x.invalid_utf8),
+          filename(move(x.filename))
     {
         x.p.clear();
         x.f = nullptr;
+        x.mapping = nullptr;
+        x.mapping_size = 0;
     }
     void operator=(const FileReader&) = delete;
     void operator=(FileReader&&) = delete;
 
     ~FileReader();
 
-    bool is_eof() const { return feof(f); }
+    // True if all chars have been read.
+    bool is_eof() const
+    {
+        return p.next_char_to_read >= p.read_buf_end &&
+               (!f || feof(f) || invalid_utf8);
+    }
+
+    // True if the chars were cut at an invalid UTF-8 sequence, which is
+    // where is_eof() becomes true.
+    bool has_invalid_utf8() const { return invalid_utf8; }
 
-    // return number of unread bytes in read buf
-    int read_ahead_at_least(int n);
+    // True if the whole file is available in memory, see mapped_span().
+    bool is_mapped() const { return !f; }
+
+    // The whole file, valid only if is_mapped(). Pointers into it stay valid
+    // for the lifetime of the FileReader so tokens can reference it.
+    cspan mapped_span() const
+    {
+        assert(is_mapped());
+        return make_span(p.read_buf_begin, p.read_buf_end - p.read_buf_begin);
+    }
 
-    // Return i-th unread char in read_buf (without advancing read position),
-    // or Nothing if i is too big.
-    // NOTE: Does not fill refill buffer!
-    Maybe<char> peek_char_in_read_buf(int i);
+    // Reader of the chars of this mapped file from `offset` on, for
+    // tokenizing the parts of a file in parallel. It doesn't own the mapping
+    // so this reader must outlive it. The chars are not validated again.
+    FileReader part_from(int offset) const;
+
+    // Next unread char and the end of the chars currently available. In
+    // mapped mode [cursor(), buf_end()) is the rest of the file, otherwise
+    // it's the unread part of the read buffer which is invalidated by the
+    // next refill. *buf_end() is always NUL.
+    const char* cursor() const { return p.next_char_to_read; }
+    const char* buf_end() const { return p.read_buf_end; }
+
+    // Move read position forward to `q` which must be in [cursor(),
+    // buf_end()].
+    void advance_to(const char* q)
+    {
+        assert(p.next_char_to_read <= q && q <= p.read_buf_end);
+        p.chars_read += q - p.next_char_to_read;
+        p.next_char_to_read = q;
+    }
 
-    // Advance read pointer and return true if string slice (p, size) is a
-    // prefix of current read_buf.
-    // NOTE: Does not fill refill buffer!
-    bool advance_if_prefix(const char* p, int size);
+    // Load the next batch after the unread chars. Call it when cursor() has
+    // reached buf_end(). Return false if there are no more chars (always in
+    // mapped mode).
+    bool refill();
 
-    // Refills read_buf if empty then return next char without advancing read
-    // position.
+    // Return i-th unread char without advancing read position, NUL after the
+    // end of file. i < c_filereader_lookahead
+    char peek(int i = 0)
+    {
+        assert(0 <= i && i < c_filereader_lookahead);
+        if (UL_UNLIKELY(p.next_char_to_read + i >= p.refill_at))
+            fill_lookahead_window();
+        return p.next_char_to_read[i];
+    }
+
+    // Advance read pointer and return true if string slice (q, size) is a
+    // prefix of the unread chars. size <= c_filereader_lookahead
+    bool advance_if_prefix(const char* q, int size);
+
+    // Return next char without advancing read position.
     // Return Nothing if eof or error
     Maybe<char> peek_next_char()
     {
-        if (UL_UNLIKELY(p.next_char_to_read >= p.read_buf_end)) {
-            p.next_char_to_read = &read_buf->front();
-            auto bytes_read = fread((void*)p.next_char_to_read, 1,
-                                    c_filereader_read_buf_capacity, f);
-            p.read_buf_end = p.next_char_to_read + bytes_read;
-            if (bytes_read == 0)
-                return Nothing;
-        }
+        if (UL_UNLIKELY(p.next_char_to_read >= p.refill_at))
+            fill_lookahead_window();
+        if (UL_UNLIKELY(p.next_char_to_read >= p.read_buf_end))
+            return Nothing;
         return *p.next_char_to_read;
     }
 
-    // Refills read_buf if empty then return next char, advances read position.
+    // Return next char, advances read position.
     // Return Nothing if eof or error
     Maybe<char> next_char()
     {
-        if (UL_UNLIKELY(p.next_char_to_read >= p.read_buf_end)) {
-            p.next_char_to_read = &read_buf->front();
-            auto bytes_read = fread((void*)p.next_char_to_read, 1,
-                                    c_filereader_read_buf_capacity, f);
-            p.read_buf_end = p.next_char_to_read + bytes_read;
-            if (bytes_read == 0)
-                return Nothing;
+        auto maybe_c = peek_next_char();
+        if (UL_LIKELY(maybe_c)) {
+            ++p.next_char_to_read;
+            ++p.chars_read;
         }
-        char c = *p.next_char_to_read;
-        ++p.next_char_to_read;
-        ++p.chars_read;
-        return c;
+        return maybe_c;
     }
     void advance()
     {
@@ -81,25 +157,57 @@ public:
     int chars_read() const { return p.chars_read; }
 
 private:
-    using ReadBuf = array<char, c_filereader_read_buf_capacity>;
+    // Room for the unread tail moved down on refill, the batch and the
+    // sentinel.
+    using ReadBuf = array<char,
+                          c_filereader_lookahead +
+                              c_filereader_read_buf_capacity +
+                              c_filereader_lookahead>;
+
+    // new_() without skipping the BOM
+    static Either<system_error, FileReader> open(string filename);
 
     FileReader(FILE* f, string filename);
+    FileReader(const char* mapping,
+               int mapping_size,
+               int size,
+               string filename);
+
+    // Read [b, e) like a mapped file, `e` is followed by the sentinel.
+    void set_chars(const char* b, const char* e);
+
+    // Refill until at least c_filereader_lookahead chars are unread or eof.
+    void fill_lookahead_window();
+
+    // Validate the newly loaded [b, p.read_buf_end), cut the chars at the
+    // first invalid sequence. `at_eof` if no more chars will follow.
+    void validate_utf8(const char* b, bool at_eof);
 
     struct P
     {
         void clear()
         {
-            next_char_to_read = read_buf_end = nullptr;
+            read_buf_begin = next_char_to_read = read_buf_end = refill_at =
+                nullptr;
             chars_read = 0;
         }
 
+        const char* read_buf_begin = nullptr;
         const char* next_char_to_read = nullptr;
         const char* read_buf_end = nullptr;
+        // Peeking at or past this needs a refill. It's read_buf_end +
+        // c_filereader_lookahead (never) if no more chars can be loaded.
+        const char* refill_at = nullptr;
         int chars_read = 0;
     } p;
 
     unique_ptr<ReadBuf> read_buf;
-    FILE* f = nullptr;
+    uptr<char[]> owned_chars;       // from_chars(), and the sentinel
+    FILE* f = nullptr;              // null in mapped mode
+    const char* mapping = nullptr;  // null for empty files and buffered mode
+    int mapping_size = 0;           // including the sentinel pages
+    Utf8Validator utf8;
+    bool invalid_utf8 = false;
     string filename;
 };
 }
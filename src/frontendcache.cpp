@@ -0,0 +1,152 @@
+#include "frontendcache.h"
+
+#include <cstring>
+#include <random>
+
+#ifdef _WIN32
+#include <direct.h>
+
+#include "nowide/convert.hpp"
+#else
+#include <sys/stat.h>
+#endif
+
+#include "hash.h"
+
+namespace maybe {
+
+// The entry format: the magic, the format, the key, the result and the
+// output.
+static const array<char, 8> c_entry_magic = {
+    {'m', 'a', 'y', 'b', 'e', 'f', 'e', 0}};
+
+template <class T>
+static void put(string& buf, const T& x)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    buf.append((const char*)&x, sizeof(x));
+}
+
+static void put_string(string& buf, const string& s)
+{
+    put<uint32_t>(buf, s.size());
+    buf.append(s.data(), s.size());
+}
+
+// Reads an entry, `ok` becomes false at the first value which doesn't fit.
+struct EntryReader
+{
+    template <class T>
+    T get()
+    {
+        T x{};
+        if (end - p < (ptrdiff_t)sizeof(x)) {
+            ok = false;
+            return x;
+        }
+        memcpy(&x, p, sizeof(x));
+        p += sizeof(x);
+        return x;
+    }
+    string get_string()
+    {
+        const auto size = get<uint32_t>();
+        if (!ok || end - p < (ptrdiff_t)size) {
+            ok = false;
+            return {};
+        }
+        string s(p, size);
+        p += size;
+        return s;
+    }
+
+    const char* p;
+    const char* end;
+    bool ok = true;
+};
+
+uint64_t FrontendCache::key(cspan chars, string_par name, uint64_t options)
+{
+    auto salt = fmt::format("{} {} {} {}", c_program_name, c_compiler_version,
+                            c_frontend_cache_format, options);
+    salt += '\0';
+    salt += name.c_str();
+    return xxhash64(chars, xxhash64(make_span(salt.data(), salt.size())));
+}
+
+string FrontendCache::entry_path(uint64_t key) const
+{
+    return fmt::format("{}/{:016x}.fe", dir, key);
+}
+
+static bool read_file(const string& path, string& chars)
+{
+    FILE* f = nowide::fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    const bool ok = read_all(f, chars);
+    fclose(f);
+    return ok;
+}
+
+// Create `dir` and its missing parents. An existing directory isn't an
+// error, the other errors show up when the entry is written.
+static void make_dirs(const string& dir)
+{
+    for (size_t i = 1; i <= dir.size(); ++i) {
+        if (i < dir.size() && dir[i] != '/' && dir[i] != '\\')
+            continue;
+        const string prefix = dir.substr(0, i);
+#ifdef _WIN32
+        _wmkdir(nowide::widen(prefix).c_str());
+#else
+        mkdir(prefix.c_str(), 0777);
+#endif
+    }
+}
+
+Maybe<FrontendResult> FrontendCache::load(uint64_t key) const
+{
+    string chars;
+    if (!read_file(entry_path(key), chars))
+        return Nothing;
+    EntryReader r{chars.data(), chars.data() + chars.size()};
+    if (r.get<array<char, 8>>() != c_entry_magic ||
+        r.get<int>() != c_frontend_cache_format || r.get<uint64_t>() != key)
+        return Nothing;
+
+    FrontendResult result;
+    result.ok = r.get<uint8_t>() != 0;
+    result.output.out = r.get_string();
+    result.output.err = r.get_string();
+    if (!r.ok || r.p != r.end)
+        return Nothing;
+    return Maybe<FrontendResult>(move(result));
+}
+
+bool FrontendCache::store(uint64_t key, const FrontendResult& result) const
+{
+    string buf;
+    put(buf, c_entry_magic);
+    put(buf, c_frontend_cache_format);
+    put(buf, key);
+    put<uint8_t>(buf, result.ok);
+    put_string(buf, result.output.out);
+    put_string(buf, result.output.err);
+
+    make_dirs(dir);
+    const auto path = entry_path(key);
+    const auto tmp_path =
+        fmt::format("{}.{:08x}.tmp", path, std::random_device{}());
+    FILE* f = nowide::fopen(tmp_path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || nowide::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        nowide::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "std.h"
+#include "utils.h"
+
+#include "log.h"
+
+namespace maybe {
+
+// The results of the front end for a source file which are replayed on a
+// cache hit: the output (diagnostics) and whether it succeeded.
+struct FrontendResult
+{
+    BufferedOutput output;
+    bool ok = false;
+};
+
+// On-disk cache of FrontendResults, one file per entry in `dir`. Entries are
+// written to a temporary file and renamed so concurrent compilers never read
+// partial ones. An entry which can't be read is a miss.
+class FrontendCache
+{
+public:
+    explicit FrontendCache(string dir) : dir(move(dir)) {}
+
+    // The key of the results of the source `chars`. It depends on the name
+    // of the source too (which is in the msgs), the compiler version and the
+    // `options` which affect the results.
+    static uint64_t key(cspan chars, string_par name, uint64_t options);
+
+    Maybe<FrontendResult> load(uint64_t key) const;
+    // False if the entry can't be written.
+    bool store(uint64_t key, const FrontendResult& r) const;
+
+private:
+    string entry_path(uint64_t key) const;
+
+    string dir;
+};
+}
@@ -4,9 +4,13 @@
 
 namespace maybe {
 
+// Set up before compilation starts and read-only afterwards, so worker
+// threads can read it without synchronization.
 struct Globals
 {
     LogLevel log_level = LogLevel::debug;
+    bool time_phases = false;  // collect the times of PhaseTimer
+    bool trace = false;        // record the TraceSpans
 };
 
 extern Globals globals;
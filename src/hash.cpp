@@ -0,0 +1,87 @@
+#include "hash.h"
+
+namespace maybe {
+
+static const uint64_t c_prime1 = 11400714785074694791ULL;
+static const uint64_t c_prime2 = 14029467366897019727ULL;
+static const uint64_t c_prime3 = 1609587929392839161ULL;
+static const uint64_t c_prime4 = 9650029242287828579ULL;
+static const uint64_t c_prime5 = 2870177450012600261ULL;
+
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// little-endian loads
+static uint64_t read64(const char* p)
+{
+    uint64_t x = 0;
+    for (int i = 7; i >= 0; --i)
+        x = (x << 8) | (uint8_t)p[i];
+    return x;
+}
+
+static uint64_t read32(const char* p)
+{
+    uint64_t x = 0;
+    for (int i = 3; i >= 0; --i)
+        x = (x << 8) | (uint8_t)p[i];
+    return x;
+}
+
+static uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * c_prime2;
+    return rotl(acc, 31) * c_prime1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t v)
+{
+    acc ^= round(0, v);
+    return acc * c_prime1 + c_prime4;
+}
+
+uint64_t xxhash64(cspan chars, uint64_t seed)
+{
+    const char* p = chars.data();
+    const char* const end = p + chars.size();
+    uint64_t h;
+    if (chars.size() >= 32) {
+        // four lanes over the 32-byte stripes
+        uint64_t v1 = seed + c_prime1 + c_prime2;
+        uint64_t v2 = seed + c_prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - c_prime1;
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    } else {
+        h = seed + c_prime5;
+    }
+    h += chars.size();
+    for (; end - p >= 8; p += 8)
+        h = rotl(h ^ round(0, read64(p)), 27) * c_prime1 + c_prime4;
+    if (end - p >= 4) {
+        h = rotl(h ^ (read32(p) * c_prime1), 23) * c_prime2 + c_prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl(h ^ ((uint8_t)*p * c_prime5), 11) * c_prime1;
+    // avalanche
+    h ^= h >> 33;
+    h *= c_prime2;
+    h ^= h >> 29;
+    h *= c_prime3;
+    h ^= h >> 32;
+    return h;
+}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "std.h"
+
+namespace maybe {
+
+// XXH64 of `chars` (the 64-bit xxHash by Yann Collet), a fast
+// non-cryptographic hash for keying the cached results of the source files.
+uint64_t xxhash64(cspan chars, uint64_t seed = 0);
+}
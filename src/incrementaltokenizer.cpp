@@ -0,0 +1,355 @@
+#include "incrementaltokenizer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "log.h"
+#include "utf8.h"
+
+namespace maybe {
+
+// Replace v[begin, end) with `xs`.
+template <class T>
+static void splice(vector<T>& v, int begin, int end, const vector<T>& xs)
+{
+    v.insert(v.erase(v.begin() + begin, v.begin() + end), xs.begin(),
+             xs.end());
+}
+
+IncrementalTokenizer::IncrementalTokenizer(string filename,
+                                           cspan text,
+                                           bool check)
+    : filename(move(filename)), check(check), source(text.begin(), text.end())
+{
+    source.append(c_filereader_lookahead, 0);
+    tokenize_all();
+}
+
+void IncrementalTokenizer::read_tokens(Tokenizer& tokenizer, vector<Token>& out)
+{
+    array<Token, c_tokenizer_batch_size> batch;
+    while (int n = tokenizer.fill(make_span(batch.data(), batch.size())))
+        out.insert(out.end(), batch.begin(), batch.begin() + n);
+}
+
+void IncrementalTokenizer::tokenize_all()
+{
+    fr = make_unique<FileReader>(
+        FileReader::from_padded_chars(text(), filename));
+    valid_utf8 = !fr->has_invalid_utf8();
+    const int first_offset = fr->cursor() - fr->mapped_span().data();
+    Tokenizer tokenizer(*fr, filename);
+    token_array.clear();
+    read_tokens(tokenizer, token_array);
+    token_payloads = move(tokenizer.payloads);
+    lines.assign(1, Line{first_offset, 0});
+    find_line_starts(first_offset, text_size(), lines);
+    set_first_tokens(1, lines.size(), 0, token_array.size());
+    indent_line = find_indent_line(1);
+}
+
+void IncrementalTokenizer::find_line_starts(int from,
+                                            int to,
+                                            vector<Line>& out) const
+{
+    // like Tokenizer::try_read_eol_after_first_char_read(), source[size()]
+    // is NUL
+    for (int i = from; i < to; ++i) {
+        const char c = source[i];
+        if (c == c_ascii_LF || (c == c_ascii_CR && source[i + 1] != c_ascii_LF))
+            out.push_back(Line{i + 1, 0});
+    }
+}
+
+void IncrementalTokenizer::set_first_tokens(int first_line,
+                                            int last_line,
+                                            int token_begin,
+                                            int token_end)
+{
+    // the tokens starting a line have line numbers
+    auto sizes = lines[first_line - 1].first_payloads;
+    int line = first_line;
+    for (int i = token_begin; i < token_end && line <= last_line; ++i) {
+        const auto& t = token_array[i];
+        if (auto ln = maybe_line_num(t)) {
+            for (; line <= std::min(*ln, last_line); ++line) {
+                lines[line - 1].first_token = i;
+                lines[line - 1].first_payloads = sizes;
+            }
+        }
+        TokenPayloads::count_payload(t, sizes);
+    }
+    for (; line <= last_line; ++line) {
+        lines[line - 1].first_token = token_end;
+        lines[line - 1].first_payloads = sizes;
+    }
+}
+
+bool IncrementalTokenizer::valid_utf8_around(int begin, int end) const
+{
+    auto continuation = [this](int i) {
+        return ((uint8_t)source[i] & 0xc0) == 0x80;
+    };
+    // the sequences starting up to 3 chars before `begin` can reach into
+    // [begin, end), the ones starting earlier are whole
+    int b = std::max(0, begin - 3);
+    while (b < begin && continuation(b))
+        ++b;
+    int e = end;
+    while (e < text_size() && continuation(e))
+        ++e;
+    Utf8Validator utf8;
+    return !utf8.feed(source.data() + b, source.data() + e) &&
+           !utf8.incomplete();
+}
+
+int IncrementalTokenizer::find_indent_line(int first_line) const
+{
+    for (int line = first_line; line <= (int)lines.size(); ++line) {
+        if (starts_with_indentation(lines[line - 1]))
+            return line;
+    }
+    return INT_MAX;
+}
+
+int IncrementalTokenizer::edit(int begin, int end, cspan replacement)
+{
+    const int lines_retokenized = retokenize(begin, end, replacement);
+    if (check)
+        CHECK(check_tokens(), "incremental token check failed");
+    return lines_retokenized;
+}
+
+// The token with its line number, if it has one.
+static string describe(const Token& t, const TokenPayloads& payloads)
+{
+    auto s = to_string(t, payloads);
+    if (auto ln = maybe_line_num(t))
+        s += fmt::format(" (line {})", *ln);
+    return s;
+}
+
+bool IncrementalTokenizer::check_tokens() const
+{
+    auto fresh_fr = FileReader::from_chars(text(), filename);
+    Tokenizer tokenizer(fresh_fr, filename);
+    vector<Token> fresh;
+    read_tokens(tokenizer, fresh);
+    const auto& fresh_payloads = tokenizer.payloads;
+    const int n = token_array.size(), nf = fresh.size();
+    int line_num = 0;
+    for (int i = 0; i < std::max(n, nf); ++i) {
+        if (i < n && i < nf &&
+            same_token(token_array[i], token_payloads, fresh[i],
+                       fresh_payloads)) {
+            if (auto ln = maybe_line_num(fresh[i]))
+                line_num = *ln;
+            continue;
+        }
+        const auto x =
+            i < n ? describe(token_array[i], token_payloads) : "none";
+        const auto y = i < nf ? describe(fresh[i], fresh_payloads) : "none";
+        report_error(ErrorInSourceFile::from_flc(
+            fmt::format("Incremental token check failed at token #{}: the "
+                        "edits give {}, the tokenizer {}.",
+                        i, x, y),
+            filename, line_num, i < nf ? fresh[i].col : token_array[i].col));
+        return false;
+    }
+    // no payloads left over
+    const auto x = token_payloads.table_sizes();
+    const auto y = fresh_payloads.table_sizes();
+    if (x.numbers != y.numbers || x.strings != y.strings ||
+        x.errors != y.errors) {
+        report_error(
+            "incremental token check of '{}' failed: the edits give {} "
+            "numbers, {} strings and {} errors, the tokenizer {}, {} and {}",
+            filename, x.numbers, x.strings, x.errors, y.numbers, y.strings,
+            y.errors);
+        return false;
+    }
+    return true;
+}
+
+int IncrementalTokenizer::retokenize(int begin, int end, cspan replacement)
+{
+    CHECK(0 <= begin && begin <= end && end <= text_size(),
+          "invalid range");
+    if (begin < (int)c_utf8_bom.size() || begin <= lines[0].offset) {
+        // may add or remove the BOM, or the edit is right after it
+        source.replace(begin, end - begin, replacement.data(),
+                       replacement.size());
+        tokenize_all();
+        return lines.size();
+    }
+    const int delta = replacement.size() - (end - begin);
+    const int replacement_end = begin + replacement.size();
+
+    // Start with the line of the char before the edit: if it's a CR, an LF
+    // inserted after it changes the line starts.
+    const int edited_line =
+        std::upper_bound(lines.begin(), lines.end(), begin - 1,
+                         [](int offset, const Line& line) {
+                             return offset < line.offset;
+                         }) -
+        lines.begin();
+    const int first = std::min(eof_line(), edited_line);
+    const int old_eof_line = eof_line();
+    const char old_indent_char =
+        indent_line != INT_MAX ? source[lines[indent_line - 1].offset] : 0;
+    source.replace(begin, end - begin, replacement.data(), replacement.size());
+
+    // Find the first line start after the replacement which was a line
+    // start before the edit, too, and with the same indentation char known.
+    // Up to that the line starts are collected.
+    int new_indent_line = indent_line < first ? indent_line : INT_MAX;
+    char new_indent_char = indent_line < first ? old_indent_char : 0;
+    if (new_indent_line == INT_MAX &&
+        starts_with_indentation(lines[first - 1])) {
+        new_indent_line = first;
+        new_indent_char = source[lines[first - 1].offset];
+    }
+    vector<Line> middle_lines;  // the ones after `first`
+    int sync_line = 0;          // the old number of the line found
+    int sync_offset = 0;
+    for (int i = lines[first - 1].offset; i < text_size(); ++i) {
+        const char c = source[i];
+        if (c != c_ascii_LF && (c != c_ascii_CR || source[i + 1] == c_ascii_LF))
+            continue;
+        const Line line{i + 1, 0};
+        const int line_num = first + middle_lines.size() + 1;
+        if (line.offset >= replacement_end) {
+            auto it = std::lower_bound(
+                lines.begin(), lines.end(), line.offset - delta,
+                [](const Line& l, int offset) { return l.offset < offset; });
+            if (it != lines.end() && it->offset == line.offset - delta) {
+                const int old_line = it - lines.begin() + 1;
+                const bool old_known = indent_line < old_line;
+                const bool new_known = new_indent_line < line_num;
+                if (old_line <= old_eof_line && old_known == new_known &&
+                    (!old_known || old_indent_char == new_indent_char)) {
+                    sync_line = old_line;
+                    sync_offset = line.offset;
+                    break;
+                }
+            }
+        }
+        middle_lines.push_back(line);
+        if (new_indent_line == INT_MAX && starts_with_indentation(line)) {
+            new_indent_line = line_num;
+            new_indent_char = source[line.offset];
+        }
+    }
+
+    // Tokenize the new lines. The text is read in place and only the chars
+    // around the replacement are validated, unless it has an invalid UTF-8
+    // sequence (which cuts it, the cut text is copied).
+    auto new_fr = make_unique<FileReader>(
+        valid_utf8 && valid_utf8_around(begin, replacement_end)
+            ? FileReader::from_valid_padded_chars(text(), filename)
+            : FileReader::from_padded_chars(text(), filename));
+    valid_utf8 = !new_fr->has_invalid_utf8();
+    const char* new_chars = new_fr->mapped_span().data();
+    auto part = new_fr->part_from(std::min<int>(
+        lines[first - 1].offset, new_fr->mapped_span().size()));
+    Tokenizer tokenizer(part, filename);
+    tokenizer.set_first_line_num(first);
+    if (indent_line < first)
+        tokenizer.set_indent_char(old_indent_char);
+    if (sync_line)
+        tokenizer.set_end_of_part(new_chars + sync_offset);
+    vector<Token> middle;
+    read_tokens(tokenizer, middle);
+    const bool synced = sync_line && tokenizer.reached_end_of_part();
+    const auto& middle_payloads = tokenizer.payloads;
+    if (token_payloads.errors.size() + middle_payloads.errors.size() >=
+        TokenPayloads::c_max_errors - 1) {
+        // the last error slot is shared, the indices can't be shifted
+        tokenize_all();
+        return lines.size();
+    }
+
+    // splice the tokens and the payloads
+    const int prefix_end = lines[first - 1].first_token;
+    const auto prefix_sizes = lines[first - 1].first_payloads;
+    const int old_suffix_begin =
+        synced ? lines[sync_line - 1].first_token : token_array.size();
+    const auto old_suffix_sizes = synced ? lines[sync_line - 1].first_payloads
+                                         : token_payloads.table_sizes();
+    if (synced) {
+        // the eof token at the end of the part
+        assert(middle.back().kind == Token::eof);
+        middle.pop_back();
+    }
+    splice(token_array, prefix_end, old_suffix_begin, middle);
+    const int suffix_begin = prefix_end + middle.size();
+    for (int i = prefix_end; i < suffix_begin; ++i)
+        token_array[i] =
+            TokenPayloads::shifted(token_array[i], prefix_sizes, 0);
+    auto& tables = token_payloads;
+    splice(tables.numbers, prefix_sizes.numbers, old_suffix_sizes.numbers,
+           middle_payloads.numbers);
+    splice(tables.strings, prefix_sizes.strings, old_suffix_sizes.strings,
+           middle_payloads.strings);
+    splice(tables.errors, prefix_sizes.errors, old_suffix_sizes.errors,
+           middle_payloads.errors);
+    const auto suffix_sizes = TokenPayloads::TableSizes{
+        prefix_sizes.numbers + (int)middle_payloads.numbers.size(),
+        prefix_sizes.strings + (int)middle_payloads.strings.size(),
+        prefix_sizes.errors + (int)middle_payloads.errors.size()};
+    const auto index_offset = TokenPayloads::TableSizes{
+        suffix_sizes.numbers - old_suffix_sizes.numbers,
+        suffix_sizes.strings - old_suffix_sizes.strings,
+        suffix_sizes.errors - old_suffix_sizes.errors};
+    const int sync_new_line = first + middle_lines.size() + 1;
+    const int line_offset = sync_new_line - sync_line;
+    if (synced) {
+        for (int i = suffix_begin; i < (int)token_array.size(); ++i) {
+            token_array[i] = TokenPayloads::shifted(token_array[i],
+                                                    index_offset, line_offset);
+        }
+        for (int i = suffix_sizes.errors; i < (int)tables.errors.size(); ++i)
+            tables.errors[i].line_num += line_offset;
+    }
+
+    // the old raw string literals are moved to the new copy of the source
+    const ptrdiff_t moved =
+        (intptr_t)new_chars - (intptr_t)fr->mapped_span().data();
+    auto move_strings = [&tables](int begin, int end, ptrdiff_t d) {
+        for (int i = begin; i < end; ++i) {
+            const auto raw = tables.strings[i];
+            tables.strings[i] = make_span(raw.data() + d, raw.size());
+        }
+    };
+    move_strings(0, prefix_sizes.strings, moved);
+    move_strings(suffix_sizes.strings, tables.strings.size(), moved + delta);
+    fr = move(new_fr);
+
+    // Splice the lines, the ones from the line found are the old ones
+    // shifted.
+    splice(lines, first, sync_line ? sync_line - 1 : lines.size(),
+           middle_lines);
+    const int token_offset = suffix_begin - old_suffix_begin;
+    for (int i = sync_new_line - 1; i < (int)lines.size(); ++i) {
+        auto& line = lines[i];
+        line.offset += delta;
+        line.first_token += token_offset;
+        line.first_payloads.numbers += index_offset.numbers;
+        line.first_payloads.strings += index_offset.strings;
+        line.first_payloads.errors += index_offset.errors;
+    }
+    if (synced) {
+        set_first_tokens(first, sync_new_line - 1, prefix_end, suffix_begin);
+        if (new_indent_line < sync_new_line)
+            indent_line = new_indent_line;
+        else if (indent_line != INT_MAX)
+            indent_line += line_offset;
+        return sync_new_line - first;
+    }
+    set_first_tokens(first, lines.size(), prefix_end, token_array.size());
+    indent_line = new_indent_line < sync_new_line
+                      ? new_indent_line
+                      : find_indent_line(sync_new_line);
+    return eof_line() - first + 1;
+}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <climits>
+
+#include "std.h"
+
+#include "tokenizer.h"
+
+namespace maybe {
+
+// Keeps the tokens of a text being edited (e.g. an editor buffer) up to
+// date without tokenizing the whole text after each edit.
+//
+// The state of the Tokenizer at the beginning of a line is just the line
+// number and the indentation char of the file, if found already. An edit
+// re-tokenizes the text from the line before it to the first line start
+// after the replaced chars where the state is the same as before the edit.
+// The new tokens and their payloads are spliced into the old ones, the old
+// tokens after them are reused with their line numbers shifted. The tokens
+// and payloads of a line are found by the checkpoints of the lines.
+//
+// The tokens are those of the Tokenizer, without the implicit tokens.
+class IncrementalTokenizer
+{
+public:
+    // `filename` is for error msgs. With `check` each edit is followed by
+    // check_tokens() (and fails if they differ).
+    IncrementalTokenizer(string filename, cspan text, bool check = false);
+
+    // Replace the chars [begin, end) of the text with `replacement` and
+    // update the tokens. Returns the number of lines re-tokenized.
+    int edit(int begin, int end, cspan replacement);
+
+    // Compare the tokens and the payloads with those of a fresh Tokenizer
+    // over the whole text and report the first difference. True if they're
+    // the same.
+    bool check_tokens() const;
+
+    // followed by c_filereader_lookahead NUL chars
+    cspan text() const { return make_span(source.data(), text_size()); }
+    const vector<Token>& tokens() const { return token_array; }
+    // The raw string literals point into the text (or a copy of it if it's
+    // not valid UTF-8), they are valid until the next edit.
+    const TokenPayloads& payloads() const { return token_payloads; }
+
+private:
+    struct Line
+    {
+        int offset;       // in `source`
+        int first_token;  // index of its first token or the next one's
+        // the payloads of the tokens before first_token
+        TokenPayloads::TableSizes first_payloads;
+    };
+
+    int retokenize(int begin, int end, cspan replacement);
+    void tokenize_all();
+    static void read_tokens(Tokenizer& tokenizer, vector<Token>& out);
+    // Append the line starts in [from, to) of `source` to `out`.
+    void find_line_starts(int from, int to, vector<Line>& out) const;
+    // Set first_token and first_payloads of the lines [first_line,
+    // last_line] from the tokens [token_begin, token_end).
+    void set_first_tokens(int first_line,
+                          int last_line,
+                          int token_begin,
+                          int token_end);
+    // True if the text is valid UTF-8 after the chars [begin, end) were
+    // replaced, given it was before. Only the chars from the sequence
+    // containing begin - 1 to the first sequence start from `end` on are
+    // validated, the old ones around them are whole sequences.
+    bool valid_utf8_around(int begin, int end) const;
+    // The first line from `first_line` on starting with indentation.
+    int find_indent_line(int first_line) const;
+    bool starts_with_indentation(const Line& line) const
+    {
+        const char c = source[line.offset];
+        return c == ' ' || c == c_ascii_tab;
+    }
+    int eof_line() const { return token_array.back().line_num(); }
+    int text_size() const { return source.size() - c_filereader_lookahead; }
+
+    string filename;
+    bool check;
+    string source;           // the text and the NUL sentinel of FileReader
+    uptr<FileReader> fr;     // reads `source`
+    bool valid_utf8 = true;  // `source` has no invalid UTF-8 sequence
+    vector<Token> token_array;
+    TokenPayloads token_payloads;
+    vector<Line> lines;  // line n is lines[n - 1]
+    // The first line starting with indentation, the Tokenizer takes the
+    // indentation char of the file from it. INT_MAX if none.
+    int indent_line = INT_MAX;
+};
+}
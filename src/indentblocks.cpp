@@ -0,0 +1,55 @@
+#include "indentblocks.h"
+
+namespace maybe {
+
+void IndentBlocks::line_start(int col,
+                              int line_num,
+                              int indent_level,
+                              TokenFifo& out)
+{
+    const auto& top = stack.back();
+    if (indent_level < top.indent_level) {
+        // close all pending blocks with indent level bigger than
+        // indent_level
+        do {
+            CHECK(stack.size() > 1);  // we expect this because stack[0] has
+                                      // a fixed zero indent level,
+                                      // indent_level cannot be less so it
+                                      // never will be removed
+            if (stack.back().region == region_indent_block) {
+                stack.pop_back();
+                out.push_back(
+                    Token::new_implicit(col, line_num, Token::end_block));
+            } else {
+                // this will be an error in the parser: closing a block
+                // without closing the parens/brackets/braces in the block
+                stack.pop_back();
+            }
+        } while (indent_level < stack.back().indent_level);
+    } else if (indent_level > top.indent_level) {
+        // open new block
+        stack.emplace_back(
+            Item{line_num, col, indent_level, region_indent_block});
+        out.push_back(Token::new_implicit(col, line_num, Token::begin_block));
+    } else {
+        // sequencing
+        out.push_back(Token::new_implicit(col, line_num, Token::sequencing));
+    }
+}
+
+void IndentBlocks::eof(int col, int line_num, TokenFifo& out)
+{
+    // close all pending blocks
+    while (stack.size() > 1) {
+        if (stack.back().region == region_indent_block) {
+            stack.pop_back();
+            out.push_back(Token::new_implicit(col, line_num, Token::end_block));
+        } else {
+            // this will be an error in the parser: closing a block
+            // without closing the parens/brackets/braces in the
+            // block
+            stack.pop_back();
+        }
+    }
+}
+}
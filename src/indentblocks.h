@@ -0,0 +1,47 @@
+#pragma once
+
+#include "std.h"
+
+#include "token.h"
+
+namespace maybe {
+
+// The block structure defined by the indentation. Turns the indentation at
+// the beginning of the lines and the end of the file into implicit
+// sequencing, begin_block and end_block tokens.
+class IndentBlocks
+{
+public:
+    IndentBlocks()
+    {
+        stack.reserve(c_begin_end_token_inserter_initial_stack_capacity);
+        stack.push_back(Item{1, 1, 0, region_indent_block});
+    }
+
+    // Push the implicit tokens for a (non-empty) line starting at `col` with
+    // `indent_level`.
+    void line_start(int col, int line_num, int indent_level, TokenFifo& out);
+
+    // Push the end_block tokens closing the blocks still open at the end of
+    // the file.
+    void eof(int col, int line_num, TokenFifo& out);
+
+private:
+    enum Region
+    {
+        region_paren,
+        region_bracket,
+        region_brace_block,
+        region_indent_block
+    };
+    struct Item
+    {
+        int line_num;
+        int col;
+        int indent_level;
+        Region region;
+    };
+
+    vector<Item> stack;
+};
+}
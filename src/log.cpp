@@ -1,4 +1,33 @@
 #include "log.h"
 
 namespace maybe {
+
+static thread_local BufferedOutput* tl_buffered_output = nullptr;
+
+BufferedOutputScope::BufferedOutputScope(BufferedOutput& bo)
+    : prev(tl_buffered_output)
+{
+    tl_buffered_output = &bo;
+}
+
+BufferedOutputScope::~BufferedOutputScope()
+{
+    tl_buffered_output = prev;
+}
+
+void write_stdout(const char* s, size_t size)
+{
+    if (tl_buffered_output)
+        tl_buffered_output->out.append(s, size);
+    else
+        fwrite(s, 1, size, stdout);
+}
+
+void write_stderr(const char* s, size_t size)
+{
+    if (tl_buffered_output)
+        tl_buffered_output->err.append(s, size);
+    else
+        fwrite(s, 1, size, stderr);
+}
 }
@@ -11,21 +11,54 @@
 
 namespace maybe {
 
+// Output of a thread collected in memory instead of being written to
+// stdout/stderr right away. Used when compiling files in parallel so the
+// output of each file can be emitted in input order.
+struct BufferedOutput
+{
+    string out, err;
+};
+
+// Redirects the output of the current thread into a BufferedOutput while in
+// scope.
+class BufferedOutputScope
+{
+public:
+    explicit BufferedOutputScope(BufferedOutput& bo);
+    ~BufferedOutputScope();
+    BufferedOutputScope(const BufferedOutputScope&) = delete;
+    void operator=(const BufferedOutputScope&) = delete;
+
+private:
+    BufferedOutput* prev;
+};
+
+// Write to stdout/stderr or to the BufferedOutput of the current thread.
+// Each call is a single write so lines of concurrent threads don't mix.
+void write_stdout(const char* s, size_t size);
+void write_stderr(const char* s, size_t size);
+inline void write_stdout(const string& s)
+{
+    write_stdout(s.data(), s.size());
+}
+inline void write_stderr(const string& s)
+{
+    write_stderr(s.data(), s.size());
+}
+
 template <typename... Args>
 [[noreturn]] void log_fatal(const char* format, const Args&... args)
 {
-    fprintf(stderr, "%s: error: ", c_program_name);
-    fmt::print(stderr, format, args...);
-    fprintf(stderr, "\n");
+    write_stderr(fmt::format("{}: error: {}\n", c_program_name,
+                             fmt::format(format, args...)));
     std::exit(EXIT_FAILURE);
 }
 
 template <typename... Args>
 void report_error(const char* format, const Args&... args)
 {
-    fprintf(stderr, "%s: error: ", c_program_name);
-    fmt::print(stderr, format, args...);
-    fprintf(stderr, "\n");
+    write_stderr(fmt::format("{}: error: {}\n", c_program_name,
+                             fmt::format(format, args...)));
 }
 
 template <typename... Args>
@@ -33,8 +66,8 @@ template <typename... Args>
                             const char* format,
                             const Args&... args)
 {
-    fmt::print(stderr, "{}: error: {} ({})\n", c_program_name,
-               fmt::format(format, args...), se.what());
+    write_stderr(fmt::format("{}: error: {} ({})\n", c_program_name,
+                             fmt::format(format, args...), se.what()));
     std::exit(EXIT_FAILURE);
 }
 
@@ -43,8 +76,8 @@ void report_error(const system_error& se,
                   const char* format,
                   const Args&... args)
 {
-    fmt::print(stderr, "{}: error: {} ({})\n", c_program_name,
-               fmt::format(format, args...), se.what());
+    write_stderr(fmt::format("{}: error: {} ({})\n", c_program_name,
+                             fmt::format(format, args...), se.what()));
 }
 
 #define LOG_DEBUG(format, ...)                                             \
@@ -54,7 +87,7 @@ void report_error(const system_error& se,
 template <typename... Args>
 void log_debug(const char* format, const Args&... args)
 {
-    fmt::print(stderr, "{}: debug: {}\n", c_program_name,
-               fmt::format(format, args...));
+    write_stderr(fmt::format("{}: debug: {}\n", c_program_name,
+                             fmt::format(format, args...)));
 }
 }
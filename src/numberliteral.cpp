@@ -0,0 +1,121 @@
+#include "numberliteral.h"
+
+#include <cstdlib>
+#include <limits>
+
+#include "fmt/format.h"
+
+namespace maybe {
+
+// Clinger's fast path: mantissas up to 2^c_ld_digits and the powers of 10
+// up to 10^c_max_exact_pow10 are exact in long double, so their product or
+// quotient is correctly rounded.
+constexpr int c_ld_digits = std::numeric_limits<long double>::digits;
+
+constexpr int max_exact_pow10()
+{
+    // 10^k = 2^k * 5^k is exact if 5^k fits the mantissa
+    int k = 0;
+    uint64_t p5 = 1;
+    while (p5 <= UINT64_MAX / 5 &&
+           (c_ld_digits >= 64 || p5 * 5 < (uint64_t(1) << c_ld_digits))) {
+        p5 *= 5;
+        ++k;
+    }
+    return k;
+}
+
+constexpr int c_max_exact_pow10 = max_exact_pow10();
+
+using Pow10Table = array<long double, c_max_exact_pow10 + 1>;
+
+constexpr Pow10Table make_pow10_table()
+{
+    Pow10Table t{};
+    long double p = 1;
+    for (int i = 0; i <= c_max_exact_pow10; ++i, p *= 10)
+        t[i] = p;
+    return t;
+}
+
+constexpr Pow10Table c_exact_pow10 = make_pow10_table();
+
+static bool fits_ld_mantissa(uint64_t m)
+{
+    return c_ld_digits >= 64 || m <= (uint64_t(1) << c_ld_digits);
+}
+
+// m *= 10^e, false on overflow
+static bool mul_pow10(uint64_t& m, int64_t e)
+{
+    for (; e > 0 && m != 0; --e) {
+        if (m > UINT64_MAX / 10)
+            return false;
+        m *= 10;
+    }
+    return true;
+}
+
+void DecimalLiteral::add_digit_slow(int d)
+{
+    if (truncated) {
+        rest += (char)('0' + d);
+        return;
+    }
+    if (d == 0) {
+        ++zeros;
+        return;
+    }
+    uint64_t m = mantissa;
+    if (mul_pow10(m, zeros + 1) && m <= UINT64_MAX - d) {
+        mantissa = m + d;
+    } else {
+        truncated = true;
+        rest.assign(zeros, '0');
+        rest += (char)('0' + d);
+    }
+    zeros = 0;
+}
+
+Nonnegative DecimalLiteral::value() const
+{
+    if (UL_UNLIKELY(truncated))
+        return slow_value();
+    // the value is m * 10^e
+    if (mantissa == 0)
+        return uint64_t{0};
+    uint64_t m = mantissa;
+    int64_t e = zeros - num_fraction_digits + exponent;
+    // the zeros at the end of the fraction, e.g. of 1.0 or 2.50e1
+    while (e < 0 && m % 10 == 0) {
+        m /= 10;
+        ++e;
+    }
+    if (e >= 0) {
+        uint64_t x = m;
+        if (mul_pow10(x, e))
+            return x;  // integer
+    }
+    if (fits_ld_mantissa(m)) {
+        const long double lm = (long double)m;
+        if (-c_max_exact_pow10 <= e && e <= c_max_exact_pow10)
+            return e < 0 ? lm / c_exact_pow10[-e] : lm * c_exact_pow10[e];
+        // the part of the exponent above c_max_exact_pow10 may still fit
+        // into the mantissa
+        uint64_t m2 = m;
+        if (e > c_max_exact_pow10 && mul_pow10(m2, e - c_max_exact_pow10) &&
+            fits_ld_mantissa(m2))
+            return (long double)m2 * c_exact_pow10[c_max_exact_pow10];
+    }
+    return slow_value();
+}
+
+long double DecimalLiteral::slow_value() const
+{
+    // The value is (mantissa followed by `rest`) * 10^e, let strtold round it.
+    // The exponent can't overflow: it's an int plus the number of digits.
+    const int64_t e = zeros - num_fraction_digits + exponent;
+    const string s = fmt::format("{}{}e{}", mantissa, rest, e);
+    return strtold(s.c_str(), nullptr);
+}
+}
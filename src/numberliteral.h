@@ -0,0 +1,54 @@
+#pragma once
+
+#include "std.h"
+
+#include "token.h"
+
+namespace maybe {
+
+// Converts the digits of a decimal literal to its value, correctly rounded:
+// an exact uint64_t if the value is an integer which fits, otherwise the
+// nearest long double (infinite on overflow).
+//
+// The digits are fed one by one while scanning the source, there's no need
+// to collect them. Values of at most 64 (long double mantissa size) bits
+// with small decimal exponents take Clinger's fast path, a single exact
+// multiplication or division. Other values are passed to strtold.
+class DecimalLiteral
+{
+public:
+    // Digits before and after the decimal point.
+    void add_digit(int d)
+    {
+        assert(0 <= d && d <= 9);
+        if (UL_LIKELY(zeros == 0 && mantissa <= (UINT64_MAX - 9) / 10 &&
+                      !truncated))
+            mantissa = 10 * mantissa + d;
+        else
+            add_digit_slow(d);
+    }
+    void add_fraction_digit(int d)
+    {
+        add_digit(d);
+        ++num_fraction_digits;
+    }
+    // The number after 'e' with its sign.
+    void set_exponent(int e) { exponent = e; }
+
+    Nonnegative value() const;
+
+private:
+    void add_digit_slow(int d);
+    long double slow_value() const;
+
+    uint64_t mantissa = 0;
+    // Zeros after the mantissa, appended only when followed by a nonzero
+    // digit: the trailing zeros of large integers don't overflow the mantissa.
+    int zeros = 0;
+    // the mantissa overflowed, the rest of the digits are in `rest`
+    bool truncated = false;
+    string rest;
+    int64_t num_fraction_digits = 0;
+    int exponent = 0;
+};
+}
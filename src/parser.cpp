@@ -1,5 +1,12 @@
 #include "parser.h"
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+
 #include "std.h"
+#include "ast.h"
+#include "stats.h"
 
 namespace maybe {
 
@@ -9,64 +16,127 @@ namespace maybe {
                                        x.length});
 #endif
 
-#define VARIANT_GET_IF_BLOCK(SUBTYPE, VAR) if (auto px = get_if<SUBTYPE>(&VAR))
+#define TOKEN_IF_KIND_BLOCK(KIND, VAR) \
+    if (const Token* px = &(VAR); px->kind == Token::KIND)
 
-using AstNodeId = int;
-
-struct AstFunction
+// An open implicit block, see ParserImpl::structure_stack.
+struct StructureStackItem
 {
-    struct Arg
-    {
-        string name;
-        Maybe<AstNodeId> type;
-    };
-    string name;
-    vector<Arg> args;
 };
 
-struct AstExpression
+struct ParseError
 {
 };
 
-using AstNode = variant<AstFunction, AstExpression>;
-
-struct Ast
+struct Eof
 {
-    template <class T, class... Args>
-    AstNodeId add_node(Args&&... args)
-    {
-        AstNodeId id = nodes.size();
-        nodes.emplace_back(in_place_aggr_type<T>, std::forward<Args>(args)...);
-        return id;
-    }
-    deque<AstNode> nodes;
 };
 
-struct StructureStackItem
+using OrAstNode = Either<ParseError, AstNodeId>;
+
+enum class Assoc : uint8_t
 {
+    left,
+    right
 };
 
-struct ParseError
+struct BinaryOperator
 {
+    const char* op;
+    uint8_t precedence;  // higher binds tighter, 0 is not an operator
+    Assoc assoc;
 };
 
-struct Eof
+// The binary operators from the loosest to the tightest binding.
+static constexpr BinaryOperator c_binary_operators[] = {
+    {"=", 1, Assoc::right},  {"+=", 1, Assoc::right}, {"-=", 1, Assoc::right},
+    {"*=", 1, Assoc::right}, {"/=", 1, Assoc::right}, {"%=", 1, Assoc::right},
+    {"||", 2, Assoc::left},  {"&&", 3, Assoc::left},  {"|", 4, Assoc::left},
+    {"^", 5, Assoc::left},   {"&", 6, Assoc::left},   {"==", 7, Assoc::left},
+    {"!=", 7, Assoc::left},  {"<", 8, Assoc::left},   {"<=", 8, Assoc::left},
+    {">", 8, Assoc::left},   {">=", 8, Assoc::left},  {"<<", 9, Assoc::left},
+    {">>", 9, Assoc::left},  {"+", 10, Assoc::left},  {"-", 10, Assoc::left},
+    {"++", 10, Assoc::left}, {"*", 11, Assoc::left},  {"/", 11, Assoc::left},
+    {"%", 11, Assoc::left},  {".", 13, Assoc::left}};
+static constexpr const char* c_prefix_operators[] = {"-", "+", "!", "~",
+                                                     "#", "&", "*"};
+static const uint8_t c_assignment_precedence = 1;
+static const uint8_t c_prefix_precedence = 12;
+// calls and indexing, same as '.'
+static const uint8_t c_postfix_precedence = 13;
+
+// The operators of the tables above by Symbol. The operator strings are
+// interned when the table is built, it's indexed by their Symbols.
+class OperatorTable
 {
+public:
+    struct Entry
+    {
+        uint8_t binary_precedence = 0;
+        Assoc assoc = Assoc::left;
+        bool prefix = false;
+    };
+
+    static const OperatorTable& get()
+    {
+        static const OperatorTable table;
+        return table;
+    }
+
+    const Entry& operator[](Symbol s) const
+    {
+        static const Entry none;
+        return s < entries.size() ? entries[s] : none;
+    }
+
+private:
+    OperatorTable()
+    {
+        for (auto& x : c_binary_operators) {
+            auto& e = entry(intern_symbol(x.op));
+            e.binary_precedence = x.precedence;
+            e.assoc = x.assoc;
+        }
+        for (auto op : c_prefix_operators)
+            entry(intern_symbol(op)).prefix = true;
+    }
+    Entry& entry(Symbol s)
+    {
+        if (s >= entries.size())
+            entries.resize(s + 1);
+        return entries[s];
+    }
+
+    vector<Entry> entries;
 };
 
-using OrAstNode = Either<ParseError, AstNode>;
+// Report the `n`th error of a file, past c_parser_max_errors only the limit
+// is reported, once.
+static void report_nth_error(ErrorInSourceFile e, int n)
+{
+    if (n > c_parser_max_errors + 1)
+        return;
+    if (n == c_parser_max_errors + 1)
+        e.msg = fmt::format("Too many errors (more than {}), stopping.",
+                            c_parser_max_errors);
+    report_error(e);
+}
 
 struct ParserImpl : Parser
 {
-    ParserImpl(TokenSource&& token_source, string filename)
-        : token_source(move(token_source)), filename(move(filename))
+    ParserImpl(TokenBatchSource& token_source,
+               const TokenPayloads& payloads,
+               string filename)
+        : token_source(token_source),
+          payloads(payloads),
+          filename(move(filename))
     {
     }
 
     void skip_whitespace()
     {
         for (;;) {
-            VARIANT_GET_IF_BLOCK(TokenWspace, peek_next_token())
+            TOKEN_IF_KIND_BLOCK(wspace, peek_next_token())
             {
                 swallow_pending_token();
                 continue;
@@ -75,77 +145,289 @@ struct ParserImpl : Parser
         }
     }
 
-    void read_until_structural_location(int structural_location)
+    // Panic-mode recovery after an error: skip the rest of the construct
+    // up to the next one at `structural_location` (a depth of
+    // structure_stack), which is before an implicit token at that depth,
+    // after the end_block returning to it or at the eof. A begin_block is
+    // left for the caller, which may parse the block or skip it.
+    // Only the errors of the tokenizer are reported on the way, the others
+    // would be follow-ups of the first one.
+    void read_until_structural_location(size_t structural_location)
     {
-        CHECK(false);
+        for (;;) {
+            if (after_end_block &&
+                structure_stack.size() == structural_location)
+                return;
+            const Token& t = peek_next_token();
+            if (t.kind == Token::eof)
+                return;
+            if (t.kind == Token::implicit &&
+                structure_stack.size() == structural_location)
+                return;
+            if (t.kind == Token::error)
+                report(payloads.error(t));
+            swallow_pending_token();
+        }
     }
 
-    OrAstNode parse_expression()
+    // Report an error of the source, the parser stops after
+    // c_parser_max_errors.
+    void report(ErrorInSourceFile e)
     {
-        CHECK(false);
-        return ParseError{};
+        const int n = ++error_accu.num_errors;
+        if (deferred_errors) {
+            if (n <= c_parser_max_errors + 1)
+                deferred_errors->push_back(move(e));
+        } else {
+            report_nth_error(move(e), n);
+        }
+    }
+    bool stopped() const
+    {
+        return error_accu.num_errors > c_parser_max_errors;
+    }
+
+    // Operator-precedence (Pratt) parser on explicit stacks: the operands
+    // are on `scratch`, the operators waiting for their right operand and
+    // the open brackets on `pending_ops`, so the native stack doesn't grow
+    // with the nesting. Stops before the first token which can't continue
+    // the expression or a binary operator below `min_precedence`.
+    OrAstNode parse_expression(uint8_t min_precedence = 0)
+    {
+        const int scratch_base = scratch.size();
+        const int ops_base = pending_ops.size();
+        auto fail = [&]() -> OrAstNode {
+            scratch.resize(scratch_base);
+            pending_ops.resize(ops_base);
+            return ParseError{};
+        };
+        bool expect_operand = true;
+        int open_brackets = 0;
+        for (;;) {
+            skip_whitespace();
+            const Token& t = peek_next_token();
+            if (expect_operand) {
+                switch (t.kind) {
+                    case Token::word:
+                        if (t.word_kind() == Token::identifier) {
+                            scratch.push_back(ast.add_node(
+                                AstNode::new_identifier(t.symbol())));
+                            expect_operand = false;
+                        } else if (t.word_kind() == Token::operator_ &&
+                                   operators[t.symbol()].prefix) {
+                            pending_ops.push_back(PendingOp{
+                                PendingOp::prefix, c_prefix_precedence,
+                                t.symbol(), 0});
+                        } else if (t.symbol() == sym_lparen) {
+                            ++open_brackets;
+                            pending_ops.push_back(
+                                PendingOp{PendingOp::paren, 0, sym_lparen,
+                                          (int)scratch.size()});
+                        } else if (t.symbol() == sym_rparen &&
+                                   (int)pending_ops.size() > ops_base &&
+                                   pending_ops.back().kind == PendingOp::call &&
+                                   pending_ops.back().base + 1 ==
+                                       (int)scratch.size()) {
+                            // call without args
+                            close_bracket();
+                            --open_brackets;
+                            expect_operand = false;
+                        } else {
+                            break;
+                        }
+                        swallow_pending_token();
+                        continue;
+                    case Token::number:
+                    case Token::string_literal:
+                        scratch.push_back(
+                            ast.add_node(AstNode::new_literal(t)));
+                        swallow_pending_token();
+                        expect_operand = false;
+                        continue;
+                    case Token::error:
+                        report(payloads.error(t));
+                        swallow_pending_token();
+                        return fail();
+                    default:
+                        break;
+                }
+                report_error_on_pending("Expected an expression.");
+                return fail();
+            }
+            // after an operand
+            if (t.kind != Token::word)
+                break;
+            const Symbol s = t.symbol();
+            if (t.word_kind() == Token::operator_) {
+                const auto& op = operators[s];
+                if (!op.binary_precedence ||
+                    (op.binary_precedence < min_precedence && !open_brackets))
+                    break;
+                reduce(ops_base, op.binary_precedence, op.assoc);
+                pending_ops.push_back(
+                    PendingOp{PendingOp::binary, op.binary_precedence, s, 0});
+                swallow_pending_token();
+                expect_operand = true;
+                continue;
+            }
+            if (t.word_kind() != Token::separator)
+                break;
+            if (s == sym_lparen || s == sym_lbracket) {
+                reduce(ops_base, c_postfix_precedence, Assoc::left);
+                // the callee or the indexed value is the first child
+                ++open_brackets;
+                pending_ops.push_back(PendingOp{
+                    s == sym_lparen ? PendingOp::call : PendingOp::index, 0, s,
+                    (int)scratch.size() - 1});
+                swallow_pending_token();
+                expect_operand = true;
+                continue;
+            }
+            if (s != sym_rparen && s != sym_rbracket && s != sym_comma)
+                break;
+            reduce(ops_base, 0, Assoc::left);
+            if ((int)pending_ops.size() == ops_base)
+                break;  // not ours, e.g. the end of the function args
+            const auto kind = pending_ops.back().kind;
+            if (s == sym_comma && kind == PendingOp::call) {
+                swallow_pending_token();
+                expect_operand = true;
+                continue;
+            }
+            if ((s == sym_rparen &&
+                 (kind == PendingOp::paren || kind == PendingOp::call)) ||
+                (s == sym_rbracket && kind == PendingOp::index)) {
+                close_bracket();
+                --open_brackets;
+                swallow_pending_token();
+                continue;
+            }
+            report_error_on_pending(
+                fmt::format("Expected '{}'.", kind == PendingOp::index ? "]"
+                                                                        : ")"));
+            return fail();
+        }
+        reduce(ops_base, 0, Assoc::left);
+        if ((int)pending_ops.size() > ops_base) {
+            report_error_on_pending(fmt::format(
+                "Expected '{}'.",
+                pending_ops.back().kind == PendingOp::index ? "]" : ")"));
+            return fail();
+        }
+        assert((int)scratch.size() == scratch_base + 1);
+        const AstNodeId id = scratch.back();
+        scratch.pop_back();
+        return id;
+    }
+
+    // Apply the prefix and binary operators on top of pending_ops (above
+    // `ops_base`) which bind tighter than an operator of `precedence` and
+    // `assoc` coming next.
+    void reduce(int ops_base, uint8_t precedence, Assoc assoc)
+    {
+        while ((int)pending_ops.size() > ops_base) {
+            const auto& top = pending_ops.back();
+            if (top.kind != PendingOp::prefix && top.kind != PendingOp::binary)
+                return;
+            if (top.precedence < precedence ||
+                (top.precedence == precedence && assoc == Assoc::right))
+                return;
+            const int arity = top.kind == PendingOp::prefix ? 1 : 2;
+            const auto operands =
+                ast.add_children(scratch, scratch.size() - arity);
+            scratch.push_back(ast.add_node(AstNode::new_operator(
+                top.kind == PendingOp::prefix ? AstNode::prefix
+                                              : AstNode::binary,
+                top.op, operands)));
+            pending_ops.pop_back();
+        }
+    }
+
+    // Pop the bracket on top of pending_ops, a parenthesized expression
+    // stays on scratch, a call or index node replaces its children.
+    void close_bracket()
+    {
+        const auto top = pending_ops.back();
+        pending_ops.pop_back();
+        if (top.kind == PendingOp::paren)
+            return;
+        const auto children = ast.add_children(scratch, top.base);
+        scratch.push_back(ast.add_node(AstNode::new_(
+            top.kind == PendingOp::call ? AstNode::call : AstNode::index,
+            children)));
+    }
+
+    // An expression statement at the top level.
+    OrAstNode parse_toplevel_statement()
+    {
+        auto or_expr = parse_expression();
+        if (is_right(or_expr) && !at_end_of_statement())
+            return ParseError{};
+        return or_expr;
     }
 
     variant<OrAstNode, Eof> parse_toplevel_expression()
     {
-        auto structural_location_before = structure_stack.size();
         skip_whitespace();
         auto& next_token = peek_next_token();
-        VARIANT_GET_IF_BLOCK(TokenImplicit, next_token)
+        TOKEN_IF_KIND_BLOCK(implicit, next_token)
         {
-            switch (px->kind) {
-                case TokenImplicit::sequencing:
+            switch (px->implicit_kind()) {
+                case Token::sequencing:
                     // empty line, do tail-recursion
                     swallow_pending_token();
                     return parse_toplevel_expression();
-                case TokenImplicit::begin_block:
-                case TokenImplicit::end_block:
+                case Token::begin_block:
+                case Token::end_block:
                     // this is invalid here
                     swallow_pending_token();
-                    report_error(ErrorInSourceFile::from_flc(
+                    report(ErrorInSourceFile::from_flc(
                         "Invalid implicit begin or end block at toplevel.",
-                        filename, px->line_num, px->col));
-                    read_until_structural_location(structural_location_before);
+                        filename, px->line_num(), px->col));
                     return ParseError{};
                 default:
                     CHECK(false);
             }
         }
-        VARIANT_GET_IF_BLOCK(TokenWord, next_token)
+        TOKEN_IF_KIND_BLOCK(word, next_token)
         {
-            switch (px->kind) {
-                case TokenWord::identifier:
-                case TokenWord::separator:
-                case TokenWord::other:
-                    return parse_expression();
-                case TokenWord::operator_:
-                    if (px->s == "+") {
+            switch (px->word_kind()) {
+                case Token::identifier:
+                case Token::separator:
+                case Token::other:
+                    return parse_toplevel_statement();
+                case Token::operator_:
+                    if (px->symbol() == sym_plus) {
                         swallow_pending_token();
                         return parse_definition_after_plus();
                     } else
-                        return parse_expression();
+                        return parse_toplevel_statement();
                 default:
                     CHECK(false);
             }
         }
-        VARIANT_GET_IF_BLOCK(TokenNumber, next_token)
+        TOKEN_IF_KIND_BLOCK(number, next_token)
         {
-            return parse_expression();
+            return parse_toplevel_statement();
         }
-        VARIANT_GET_IF_BLOCK(TokenStringLiteral, next_token)
+        TOKEN_IF_KIND_BLOCK(string_literal, next_token)
         {
-            return parse_expression();
+            return parse_toplevel_statement();
         }
-        VARIANT_GET_IF_BLOCK(TokenEof, next_token) { return Eof{}; }
-        VARIANT_GET_IF_BLOCK(ErrorInSourceFile, next_token)
+        TOKEN_IF_KIND_BLOCK(eof, next_token) { return Eof{}; }
+        TOKEN_IF_KIND_BLOCK(error, next_token)
         {
+            report(payloads.error(*px));
+            swallow_pending_token();
             return ParseError{};
         }
         CHECK(false);
-        return AstNode{};
+        return ParseError{};
     }
 
-    void handle_toplevel_expr(AstNode node) {}
+    void handle_toplevel_expr(AstNodeId id) { ast.toplevel.push_back(id); }
+
+    const Ast& syntax_tree() const override { return ast; }
 
     virtual bool parse_toplevel_loop() override
     {
@@ -158,6 +440,14 @@ struct ParserImpl : Parser
             {
                 if (is_left(x)) {
                     ++error_count;
+                    read_until_structural_location(0);
+                    // the block of the item is parsed for its errors
+                    const Token& t = peek_next_token();
+                    if (t.kind == Token::implicit &&
+                        t.implicit_kind() == Token::begin_block) {
+                        swallow_pending_token();
+                        parse_block();
+                    }
                 } else {
                     handle_toplevel_expr(right(x));
                 }
@@ -165,49 +455,63 @@ struct ParserImpl : Parser
             else IF_VISITED_VARIANT_IS(x, Eof) { exit_loop = true; }
             else ERROR_VARIANT_VISIT_NOT_EXHAUSTIVE(x);
             END_VISIT_VARIANT(toplevel_expr)
-        } while (!exit_loop);
+        } while (!exit_loop && !stopped());
+        // the stages before the parser (printing, recording) see all the
+        // tokens even if it stopped
+        while (read_token().kind != Token::eof) {
+        }
+        stats.add(Counter::ast_nodes, ast.nodes.size());
         return error_count == 0;
     }
 
-    OrAstNode parse_expression_starting_with(Token& token) { CHECK(false); }
-
+    // Report `msg` at the pending token and swallow it. An error token
+    // reports its own msg instead, the tokenizer's.
     void report_error_on_pending(string msg)
     {
         auto& pending_token = peek_next_token();
-        report_error(ErrorInSourceFile::from_flcl(
+        if (pending_token.kind == Token::error) {
+            report(payloads.error(pending_token));
+            swallow_pending_token();
+            return;
+        }
+        report(ErrorInSourceFile::from_flcl(
             move(msg), filename, current_or_peeked_line_num, col(pending_token),
             length(pending_token)));
-        swallow_pending_token();
+        // the implicit tokens are left for the structure of the lines
+        if (pending_token.kind != Token::implicit &&
+            pending_token.kind != Token::eof)
+            swallow_pending_token();
     }
 
-    Either<ParseError, AstFunction::Arg> parse_function_argument_in_definition()
+    OrAstNode parse_function_argument_in_definition()
     {
         // identifier [: typename], where
         // typename ::= identifier+
 
-        string variable_name;
-        VARIANT_GET_IF_BLOCK(TokenWord, peek_next_token())
+        skip_whitespace();
+        Maybe<Symbol> variable_name;
+        TOKEN_IF_KIND_BLOCK(word, peek_next_token())
         {
-            if (px->kind == TokenWord::identifier) {
-                variable_name = move(px->s);
+            if (px->word_kind() == Token::identifier) {
+                variable_name = px->symbol();
                 swallow_pending_token();
             }
         }
 
-        if (variable_name.empty()) {
+        if (!variable_name) {
             report_error_on_pending("Expected valid variable name.");
             return ParseError{};
         }
 
         skip_whitespace();
         bool expect_type = false;
-        VARIANT_GET_IF_BLOCK(TokenWord, peek_next_token())
+        TOKEN_IF_KIND_BLOCK(word, peek_next_token())
         {
-            if (px->kind != TokenWord::separator &&
-                px->s == c_lang_separator_between_varname_and_type) {
+            if (px->word_kind() != Token::separator ||
+                px->symbol() != c_lang_separator_between_varname_and_type) {
                 // then we're done with the variable name
-                return AstFunction::Arg{move(variable_name),
-                                        Nothing};  // create our first AstNode
+                return ast.add_node(
+                    AstNode::new_function_arg(*variable_name, AstRange{}));
             } else {
                 swallow_pending_token();
                 expect_type = true;
@@ -216,8 +520,9 @@ struct ParserImpl : Parser
 
         if (!expect_type) {
             report_error_on_pending(
-                fmt::format("Expected '%s' after variable name.",
-                            c_lang_separator_between_varname_and_type));
+                fmt::format("Expected '{}' after variable name.",
+                            symbol_str(
+                                c_lang_separator_between_varname_and_type)));
             return ParseError{};
         }
 
@@ -226,16 +531,43 @@ struct ParserImpl : Parser
         if (is_left(or_expr))
             return ParseError{};
 
-        return AstFunction::Arg{move(variable_name), right(or_expr)};
+        scratch.push_back(right(or_expr));
+        const auto type = ast.add_children(scratch, scratch.size() - 1);
+        return ast.add_node(AstNode::new_function_arg(*variable_name, type));
+    }
+
+    // Skip the rest of a function argument with an error up to the next ','
+    // or ')' outside of brackets on its line. Returns false if there's none.
+    bool skip_function_argument()
+    {
+        int depth = 0;
+        for (;;) {
+            skip_whitespace();
+            const Token& t = peek_next_token();
+            if (t.kind == Token::implicit || t.kind == Token::eof)
+                return false;
+            if (t.kind == Token::word && t.word_kind() == Token::separator) {
+                const Symbol s = t.symbol();
+                if (depth == 0 && (s == sym_comma || s == sym_rparen))
+                    return true;
+                if (s == sym_lparen || s == sym_lbracket)
+                    ++depth;
+                else if ((s == sym_rparen || s == sym_rbracket) && depth > 0)
+                    --depth;
+            } else if (t.kind == Token::error) {
+                report(payloads.error(t));
+            }
+            swallow_pending_token();
+        }
     }
 
     OrAstNode parse_definition_after_plus()
     {
         skip_whitespace();
         auto& next_token = peek_next_token();
-        VARIANT_GET_IF_BLOCK(TokenWord, next_token)
+        TOKEN_IF_KIND_BLOCK(word, next_token)
         {
-            if (px->s == "fn") {
+            if (px->symbol() == sym_fn) {
                 swallow_pending_token();
                 return parse_definition_after_plus_fn();
             }
@@ -248,14 +580,14 @@ struct ParserImpl : Parser
     OrAstNode parse_definition_after_plus_fn()
     {
         skip_whitespace();
-        string function_name;
-        VARIANT_GET_IF_BLOCK(TokenWord, peek_next_token())
+        Maybe<Symbol> function_name;
+        TOKEN_IF_KIND_BLOCK(word, peek_next_token())
         {
-            if (px->kind == TokenWord::identifier)
-                function_name = move(px->s);
+            if (px->word_kind() == Token::identifier)
+                function_name = px->symbol();
         }
 
-        if (function_name.empty()) {
+        if (!function_name) {
             report_error_on_pending("Expected: function name.");
             return ParseError{};
         }
@@ -263,9 +595,10 @@ struct ParserImpl : Parser
         swallow_pending_token();
 
         bool open_paren_found = false;
-        VARIANT_GET_IF_BLOCK(TokenWord, peek_next_token())
+        TOKEN_IF_KIND_BLOCK(word, peek_next_token())
         {
-            if (px->kind == TokenWord::separator && px->s == "(")
+            if (px->word_kind() == Token::separator &&
+                px->symbol() == sym_lparen)
                 open_paren_found = true;
         }
 
@@ -276,37 +609,233 @@ struct ParserImpl : Parser
 
         swallow_pending_token();
 
-        // loop on arguments
-        vector<AstNode> fnargs;
+        // loop on arguments, collected on the scratch stack, an argument
+        // with an error is skipped and the definition fails at its end
+        const int args_begin = scratch.size();
+        int num_args = 0;
+        bool failed = false;
         for (;;) {
             skip_whitespace();
             bool comma_found = false;
-            VARIANT_GET_IF_BLOCK(TokenWord, peek_next_token())
+            TOKEN_IF_KIND_BLOCK(word, peek_next_token())
             {
-                if (px->kind == TokenWord::separator) {
-                    if (px->s == ")") {
+                if (px->word_kind() == Token::separator) {
+                    if (px->symbol() == sym_rparen) {
                         swallow_pending_token();
                         break;
-                    } else if (px->s == ",") {
+                    } else if (px->symbol() == sym_comma) {
                         swallow_pending_token();
                         comma_found = true;
                     }
                 }
             }
-            if (!fnargs.empty() && !comma_found) {
+            if (num_args > 0 && !comma_found) {
                 report_error_on_pending(
                     "Expected: comma or closing parenthesis.");
+            } else {
+                ++num_args;
+                auto or_fnarg = parse_function_argument_in_definition();
+                if (is_right(or_fnarg)) {
+                    scratch.push_back(right(or_fnarg));
+                    continue;
+                }
+            }
+            failed = true;
+            if (!skip_function_argument()) {
+                scratch.resize(args_begin);
                 return ParseError{};
             }
+        }
+        // Successfully parsed fnargs.
+        // Expected: [-> type] then either '= expression' or new block
+        skip_whitespace();
+        bool has_return_type = false;
+        TOKEN_IF_KIND_BLOCK(word, peek_next_token())
+        {
+            if (px->symbol() == sym_arrow) {
+                swallow_pending_token();
+                // stop at the '=' of the body
+                auto or_type = parse_expression(c_assignment_precedence + 1);
+                if (is_left(or_type)) {
+                    scratch.resize(args_begin);
+                    return ParseError{};
+                }
+                scratch.push_back(right(or_type));
+                has_return_type = true;
+                skip_whitespace();
+            }
+        }
+        OrAstNode or_body = ParseError{};
+        const Token& t = peek_next_token();
+        if (t.kind == Token::word && t.symbol() == sym_assign) {
+            swallow_pending_token();
+            or_body = parse_expression();
+            if (is_right(or_body) && !at_end_of_statement())
+                or_body = ParseError{};
+        } else if (t.kind == Token::implicit &&
+                   t.implicit_kind() == Token::begin_block) {
+            swallow_pending_token();
+            or_body = parse_block();
+        } else {
+            report_error_on_pending("Expected: '=' or an indented block.");
+        }
+        if (is_left(or_body) || failed) {
+            scratch.resize(args_begin);
+            return ParseError{};
+        }
+        scratch.push_back(right(or_body));
+        const auto children = ast.add_children(scratch, args_begin);
+        return ast.add_node(
+            AstNode::new_function(*function_name, has_return_type, children));
+    }
 
-            auto or_fnarg = parse_function_argument_in_definition();
-            if (is_left(or_fnarg))
+    // The statements of an indented block, after its begin_block token. The
+    // blocks nested in it are parsed in the same loop on `open_blocks`. A
+    // statement with an error is skipped (see
+    // read_until_structural_location()) so the errors of the next ones are
+    // reported, too, then the block fails at its end.
+    OrAstNode parse_block()
+    {
+        const int scratch_base = scratch.size();
+        const int blocks_base = open_blocks.size();
+        open_blocks.push_back(OpenBlock{AstNode::block, scratch_base});
+        bool failed = false;
+        for (;;) {
+            skip_whitespace();
+            const Token& t = peek_next_token();
+            if (t.kind == Token::implicit &&
+                t.implicit_kind() != Token::begin_block) {
+                const bool end_block = t.implicit_kind() == Token::end_block;
+                swallow_pending_token();
+                if (!end_block)
+                    continue;
+                const auto id = close_block();
+                if ((int)open_blocks.size() > blocks_base) {
+                    scratch.push_back(id);
+                    continue;
+                }
+                if (failed) {
+                    scratch.resize(scratch_base);
+                    return ParseError{};
+                }
+                return id;
+            }
+            if (t.kind == Token::eof) {
+                // the inserter closes the blocks before the eof
+                scratch.resize(scratch_base);
+                open_blocks.resize(blocks_base);
                 return ParseError{};
-            fnargs.emplace_back(move(right(or_fnarg)));
+            }
+            const auto statement_location = structure_stack.size();
+            const int statement_begin = scratch.size();
+            if (!parse_statement()) {
+                failed = true;
+                scratch.resize(statement_begin);
+                read_until_structural_location(statement_location);
+                // the statements of an indented block right after the
+                // error are parsed still, their errors are independent
+                const Token& b = peek_next_token();
+                if (b.kind == Token::implicit &&
+                    b.implicit_kind() == Token::begin_block) {
+                    swallow_pending_token();
+                    open_blocks.push_back(
+                        OpenBlock{AstNode::block, (int)scratch.size()});
+                }
+            }
         }
-        // Successfully parsed fnargs.
-        // Expected: either '= expression' or new block
-        CHECK(false);
+    }
+
+    // A statement of the block on top of open_blocks. The statements with a
+    // block (if, while, else) are pushed on open_blocks. Returns false after
+    // reporting an error.
+    bool parse_statement()
+    {
+        const Token& t = peek_next_token();
+        if (t.kind == Token::implicit) {
+            assert(t.implicit_kind() == Token::begin_block);
+            report_error_on_pending("Unexpected indentation.");
+            return false;
+        }
+        if (t.kind == Token::word && t.word_kind() == Token::identifier) {
+            const Symbol s = t.symbol();
+            if (s == sym_if || s == sym_while || s == sym_else) {
+                swallow_pending_token();
+                if (s != sym_else) {
+                    auto or_cond = parse_expression();
+                    if (is_left(or_cond))
+                        return false;
+                    scratch.push_back(right(or_cond));
+                }
+                skip_whitespace();
+                const Token& b = peek_next_token();
+                if (b.kind != Token::implicit ||
+                    b.implicit_kind() != Token::begin_block) {
+                    report_error_on_pending("Expected: an indented block.");
+                    return false;
+                }
+                swallow_pending_token();
+                // the block is the last child of the statement
+                open_blocks.push_back(
+                    OpenBlock{s == sym_if      ? AstNode::if_
+                              : s == sym_while ? AstNode::while_
+                                               : AstNode::else_,
+                              (int)scratch.size() - (s != sym_else)});
+                return true;
+            }
+            if (s == sym_return) {
+                swallow_pending_token();
+                skip_whitespace();
+                const int begin = scratch.size();
+                const auto kind = peek_next_token().kind;
+                if (kind != Token::implicit && kind != Token::eof) {
+                    auto or_value = parse_expression();
+                    if (is_left(or_value))
+                        return false;
+                    scratch.push_back(right(or_value));
+                }
+                const auto children = ast.add_children(scratch, begin);
+                scratch.push_back(
+                    ast.add_node(AstNode::new_(AstNode::return_, children)));
+                return at_end_of_statement();
+            }
+        }
+        auto or_expr = parse_expression();
+        if (is_left(or_expr))
+            return false;
+        scratch.push_back(right(or_expr));
+        return at_end_of_statement();
+    }
+
+    // Reports the error if the statement isn't followed by the end of its
+    // line.
+    bool at_end_of_statement()
+    {
+        skip_whitespace();
+        const auto kind = peek_next_token().kind;
+        if (kind == Token::implicit || kind == Token::eof)
+            return true;
+        report_error_on_pending("Expected: the end of the line.");
+        return false;
+    }
+
+    // Make the node of the block on top of open_blocks from its statements
+    // on scratch, with its statement (if, while, else) if any.
+    AstNodeId close_block()
+    {
+        const auto b = open_blocks.back();
+        open_blocks.pop_back();
+        const int statements_begin =
+            b.kind == AstNode::if_ || b.kind == AstNode::while_
+                ? b.children_begin + 1
+                : b.children_begin;
+        const auto statements = ast.add_children(scratch, statements_begin);
+        const auto block =
+            ast.add_node(AstNode::new_(AstNode::block, statements));
+        if (b.kind == AstNode::block)
+            return block;
+        scratch.push_back(block);
+        const auto children = ast.add_children(scratch, b.children_begin);
+        return ast.add_node(AstNode::new_(b.kind, children));
     }
 
     Token& next_token()
@@ -314,19 +843,21 @@ struct ParserImpl : Parser
         if (pending_token) {
             Token* token = pending_token;
             pending_token = nullptr;
+            track_structure(*token);
             return *token;
         } else {
-            Token& result = token_source();
+            Token& result = read_token();
             auto maybe_line_num = maybe::maybe_line_num(result);
             if (maybe_line_num)
                 current_or_peeked_line_num = *maybe_line_num;
+            track_structure(result);
             return result;
         }
     }
     Token& peek_next_token()
     {
         if (!pending_token) {
-            pending_token = &token_source();
+            pending_token = &read_token();
             auto maybe_line_num = maybe::maybe_line_num(*pending_token);
             if (maybe_line_num)
                 current_or_peeked_line_num = *maybe_line_num;
@@ -336,26 +867,296 @@ struct ParserImpl : Parser
     void swallow_pending_token()
     {
         CHECK(pending_token);
+        track_structure(*pending_token);
         pending_token = nullptr;
     }
+    // Update structure_stack with the token consumed.
+    void track_structure(const Token& t)
+    {
+        after_end_block = false;
+        if (t.kind != Token::implicit)
+            return;
+        if (t.implicit_kind() == Token::begin_block) {
+            structure_stack.push_back(StructureStackItem{});
+        } else if (t.implicit_kind() == Token::end_block &&
+                   !structure_stack.empty()) {
+            structure_stack.pop_back();
+            after_end_block = true;
+        }
+    }
+    // Next token from the current batch, the eof token is repeated after the
+    // end.
+    Token& read_token()
+    {
+        if (UL_UNLIKELY(batch_next == batch_end)) {
+            const int n =
+                token_source.fill(make_span(batch.data(), batch.size()));
+            if (UL_UNLIKELY(n == 0)) {
+                CHECK(batch_end > 0 && batch[batch_end - 1].kind == Token::eof);
+                return batch[batch_end - 1];
+            }
+            batch_next = 0;
+            batch_end = n;
+        }
+        return batch[batch_next++];
+    }
 
-    TokenSource token_source;
+    TokenBatchSource& token_source;
+    array<Token, c_tokenizer_batch_size> batch;
+    int batch_next = 0, batch_end = 0;
+    const TokenPayloads& payloads;
 
     int current_indent;
     int current_line_num;
 
     bool exit_loop = false;
-    ErrorAccu error_accu;
+    ErrorAccu error_accu{0};
+    // if not null the errors are collected here instead of being reported,
+    // see ParallelParser
+    vector<ErrorInSourceFile>* deferred_errors = nullptr;
     string filename;
 
+    // the implicit blocks open at the last token consumed
     vector<StructureStackItem> structure_stack;
+    bool after_end_block = false;  // the last token consumed closed a block
+    Ast ast;
+    // the children of the nodes being parsed, see Ast::add_children()
+    vector<AstNodeId> scratch;
+
+    // An operator waiting for its right operand or an open bracket, see
+    // parse_expression().
+    struct PendingOp
+    {
+        enum Kind : uint8_t
+        {
+            prefix,
+            binary,
+            paren,
+            call,
+            index,
+        };
+        Kind kind;
+        uint8_t precedence;  // prefix, binary
+        Symbol op;
+        int base;  // paren, call, index: the first child on scratch
+    };
+    vector<PendingOp> pending_ops;
+    const OperatorTable& operators = OperatorTable::get();
+
+    // A block being parsed, see parse_block().
+    struct OpenBlock
+    {
+        AstNode::Kind kind;  // block or the statement of the block
+        int children_begin;  // on scratch: the condition or the statements
+    };
+    vector<OpenBlock> open_blocks;
 
     Token* pending_token = nullptr;
     int current_or_peeked_line_num = 0;
 };
 
-uptr<Parser> Parser::new_(TokenSource&& token_source, string filename)
+// TokenBatchSource reading the tokens [begin, end) of an array, then an eof
+// token.
+class TokenRangeSource : public TokenBatchSource
+{
+public:
+    TokenRangeSource(span<const Token> tokens, const Token& eof)
+        : tokens(tokens), eof(eof)
+    {
+    }
+    int fill(span<Token> out) override
+    {
+        const int n = std::min<ptrdiff_t>(out.size(), tokens.size() - next);
+        std::copy_n(tokens.begin() + next, n, out.begin());
+        next += n;
+        if (n < out.size() && !had_eof) {
+            out[n] = eof;
+            had_eof = true;
+            return n + 1;
+        }
+        return n;
+    }
+
+private:
+    span<const Token> tokens;
+    const Token eof;
+    ptrdiff_t next = 0;
+    bool had_eof = false;
+};
+
+// Parses the top-level items of a file in chunks on multiple threads. The
+// items are separated by the zero-indent points of the implicit token
+// stream: a sequencing token outside of the blocks or the first token after
+// the end_block closing the last open block. Each chunk is parsed by its own
+// ParserImpl into its own Ast, then the ASTs are appended and the errors
+// collected by the parsers reported in source order, under the error limit
+// of the file.
+//
+// A chunk split at a sequencing token keeps it as its last token (the
+// parser may report the errors of its last item there) and the next chunk
+// starts with it, too. The parser of a chunk starts at the line number of
+// the tokens before it, for the errors on tokens without line numbers.
+class ParallelParser : public Parser
+{
+public:
+    ParallelParser(const vector<Token>& tokens,
+                   const TokenPayloads& payloads,
+                   string filename,
+                   int num_threads)
+        : tokens(tokens),
+          payloads(payloads),
+          filename(move(filename)),
+          num_threads(num_threads)
+    {
+        CHECK(!tokens.empty() && tokens.back().kind == Token::eof);
+    }
+
+    bool parse_toplevel_loop() override
+    {
+        split_into_chunks();
+        vector<std::exception_ptr> exceptions(chunks.size());
+        auto parse_chunk = [this, &exceptions](int i) {
+            try {
+                parse(chunks[i]);
+            } catch (...) {
+                exceptions[i] = std::current_exception();
+            }
+        };
+        vector<std::thread> threads;
+        threads.reserve(chunks.size() - 1);
+        for (int i = 1; i < (int)chunks.size(); ++i)
+            threads.emplace_back(parse_chunk, i);
+        parse_chunk(0);  // on this thread
+        for (auto& t : threads)
+            t.join();
+        for (auto& e : exceptions)
+            if (e)
+                std::rethrow_exception(e);
+
+        bool ok = true;
+        int num_errors = 0;
+        ast.clear();
+        for (auto& chunk : chunks) {
+            for (auto& e : chunk.errors)
+                report_nth_error(move(e), ++num_errors);
+            ast.append(chunk.ast);
+            ok = ok && chunk.ok;
+        }
+        chunks.clear();
+        return ok;
+    }
+
+    const Ast& syntax_tree() const override { return ast; }
+
+private:
+    struct Chunk
+    {
+        int begin, end;      // indices in `tokens`
+        int first_line_num;  // current line of the parser at `begin`
+        Token eof;
+        Ast ast;
+        vector<ErrorInSourceFile> errors;  // reported in order by the merge
+        bool ok = false;
+    };
+
+    void split_into_chunks()
+    {
+        const int size = tokens.size();
+        const int n = num_chunks(size, num_threads);
+        chunks.clear();
+        chunks.reserve(n);
+        chunks.emplace_back();
+        chunks.back().begin = 0;
+        chunks.back().first_line_num = 0;
+        int depth = 0;
+        int line_num = 0;
+        // the last token is the eof, it's not a split point
+        for (int i = 0; i + 1 < size && (int)chunks.size() < n; ++i) {
+            const Token& t = tokens[i];
+            if (auto ln = maybe_line_num(t))
+                line_num = *ln;
+            const bool at_split =
+                depth == 0 && i > chunks.back().begin &&
+                (int64_t)size * (int)chunks.size() / n <= i;
+            if (t.kind == Token::implicit) {
+                switch (t.implicit_kind()) {
+                    case Token::sequencing:
+                        if (at_split)
+                            add_chunk(i, i + 1, line_num);
+                        break;
+                    case Token::begin_block:
+                        ++depth;
+                        break;
+                    case Token::end_block:
+                        --depth;
+                        break;
+                }
+            } else if (at_split && i > 0 &&
+                       tokens[i - 1].kind == Token::implicit &&
+                       tokens[i - 1].implicit_kind() == Token::end_block) {
+                add_chunk(i, i, line_num);
+            }
+        }
+        auto& last = chunks.back();
+        last.end = size - 1;
+        last.eof = tokens.back();
+    }
+
+    // End the last chunk at `end` and start the next one at `begin`, at
+    // line `line_num`.
+    void add_chunk(int begin, int end, int line_num)
+    {
+        auto& prev = chunks.back();
+        prev.end = end;
+        prev.eof = Token::new_eof(tokens[begin].col, line_num, false);
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().first_line_num = line_num;
+    }
+
+    void parse(Chunk& chunk)
+    {
+        PhaseTimer timer(Phase::parse);
+        TraceSpan span(
+            fmt::format("{} tokens [{}, {})", filename, chunk.begin, chunk.end),
+            "parse");
+        TokenRangeSource source(
+            make_span(tokens.data() + chunk.begin, chunk.end - chunk.begin),
+            chunk.eof);
+        ParserImpl parser(source, payloads, filename);
+        parser.current_or_peeked_line_num = chunk.first_line_num;
+        parser.deferred_errors = &chunk.errors;
+        chunk.ok = parser.parse_toplevel_loop();
+        chunk.ast = move(parser.ast);
+    }
+
+    const vector<Token>& tokens;
+    const TokenPayloads& payloads;
+    string filename;
+    const int num_threads;
+    vector<Chunk> chunks;
+    Ast ast;
+};
+
+uptr<Parser> Parser::new_(TokenBatchSource& token_source,
+                          const TokenPayloads& payloads,
+                          string filename)
+{
+    return make_unique<ParserImpl>(token_source, payloads, move(filename));
+}
+
+uptr<Parser> Parser::new_parallel(const vector<Token>& tokens,
+                                  const TokenPayloads& payloads,
+                                  string filename,
+                                  int num_threads)
+{
+    return make_unique<ParallelParser>(tokens, payloads, move(filename),
+                                       num_threads);
+}
+
+int Parser::num_chunks(int num_tokens, int num_threads)
 {
-    return make_unique<ParserImpl>(move(token_source), move(filename));
+    return std::max(
+        1, std::min(num_threads, num_tokens / c_parser_min_chunk_tokens));
 }
 }
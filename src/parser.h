@@ -2,14 +2,32 @@
 
 #include "tokenizer.h"
 #include "log.h"
+#include "ast.h"
 
 namespace maybe {
 
 struct Parser
 {
-    static uptr<Parser> new_(TokenSource&& token_source, string filename);
+    // `payloads` are the payloads of the tokens from `token_source`, both
+    // must outlive the parser.
+    static uptr<Parser> new_(TokenBatchSource& token_source,
+                             const TokenPayloads& payloads,
+                             string filename);
+    // Parses the top-level items of `tokens` (ending with the eof token) in
+    // chunks on up to `num_threads` threads, see num_chunks(). The
+    // diagnostics are the same as those of new_(), the AST too unless the
+    // parser stops on too many errors. `tokens` and `payloads` must outlive
+    // the parser.
+    static uptr<Parser> new_parallel(const vector<Token>& tokens,
+                                     const TokenPayloads& payloads,
+                                     string filename,
+                                     int num_threads);
+    // Number of chunks new_parallel() splits `num_tokens` tokens into.
+    static int num_chunks(int num_tokens, int num_threads);
 
     virtual bool parse_toplevel_loop() = 0;
+    // the AST parsed by parse_toplevel_loop()
+    virtual const Ast& syntax_tree() const = 0;
     virtual ~Parser() {}
 };
 }
@@ -0,0 +1,203 @@
+#include "simdscan.h"
+
+#include "charclass.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || \
+    (defined(__i386__) && defined(__SSE2__))
+#define MAYBE_SIMDSCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MAYBE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MAYBE_TARGET_AVX2
+#endif
+
+namespace maybe {
+
+// scalar fallback
+
+template <uint16_t CC>
+const char* scan_scalar(const char* p)
+{
+    while (has_char_class(*p, CC))
+        ++p;
+    return p;
+}
+
+static const ScanKernels c_scalar_kernels = {
+    "scalar", scan_scalar<cc_identifier>, scan_scalar<cc_inline_wspace>,
+    scan_scalar<cc_comment_char>, scan_scalar<cc_literal_char>};
+
+#ifdef MAYBE_SIMDSCAN_X86
+
+inline int count_trailing_zeros(uint32_t x)
+{
+    assert(x != 0);
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return (int)r;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// The masks below are computed with signed byte compares: bytes >= 0x80 are
+// negative.
+
+// SSE2
+
+inline __m128i identifier_mask_sse2(__m128i c)
+{
+    // 'A'-'Z' are mapped to 'a'-'z', nothing else is mapped into 'a'-'z'
+    const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    const __m128i alpha =
+        _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                      _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    const __m128i digit =
+        _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                      _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    return _mm_or_si128(alpha, digit);
+}
+
+inline __m128i inline_wspace_mask_sse2(__m128i c)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                        _mm_cmpeq_epi8(c, _mm_set1_epi8(c_ascii_tab)));
+}
+
+inline __m128i comment_mask_sse2(__m128i c)
+{
+    // >= 0x20 (including the bytes >= 0x80) or TAB
+    return _mm_or_si128(
+        _mm_or_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(0x1f)),
+                     _mm_cmplt_epi8(c, _mm_setzero_si128())),
+        _mm_cmpeq_epi8(c, _mm_set1_epi8(c_ascii_tab)));
+}
+
+inline __m128i literal_mask_sse2(__m128i c)
+{
+    // >= 0x20 (including the bytes >= 0x80) but not '"' or '\\'
+    const __m128i printable =
+        _mm_or_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(0x1f)),
+                     _mm_cmplt_epi8(c, _mm_setzero_si128()));
+    const __m128i special =
+        _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(c, _mm_set1_epi8('\\')));
+    return _mm_andnot_si128(special, printable);
+}
+
+template <__m128i (*Mask)(__m128i)>
+const char* scan_sse2(const char* p)
+{
+    for (;;) {
+        const __m128i c = _mm_loadu_si128((const __m128i*)p);
+        const uint32_t stop = ~(uint32_t)_mm_movemask_epi8(Mask(c)) & 0xffff;
+        if (stop)
+            return p + count_trailing_zeros(stop);
+        p += 16;
+    }
+}
+
+static const ScanKernels c_sse2_kernels = {
+    "sse2", scan_sse2<identifier_mask_sse2>,
+    scan_sse2<inline_wspace_mask_sse2>, scan_sse2<comment_mask_sse2>,
+    scan_sse2<literal_mask_sse2>};
+
+// AVX2
+
+MAYBE_TARGET_AVX2 inline __m256i identifier_mask_avx2(__m256i c)
+{
+    const __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    const __m256i alpha = _mm256_and_si256(
+        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    const __m256i digit =
+        _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+    return _mm256_or_si256(alpha, digit);
+}
+
+MAYBE_TARGET_AVX2 inline __m256i inline_wspace_mask_avx2(__m256i c)
+{
+    return _mm256_or_si256(
+        _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(c, _mm256_set1_epi8(c_ascii_tab)));
+}
+
+MAYBE_TARGET_AVX2 inline __m256i comment_mask_avx2(__m256i c)
+{
+    return _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(0x1f)),
+                        _mm256_cmpgt_epi8(_mm256_setzero_si256(), c)),
+        _mm256_cmpeq_epi8(c, _mm256_set1_epi8(c_ascii_tab)));
+}
+
+MAYBE_TARGET_AVX2 inline __m256i literal_mask_avx2(__m256i c)
+{
+    const __m256i printable =
+        _mm256_or_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(0x1f)),
+                        _mm256_cmpgt_epi8(_mm256_setzero_si256(), c));
+    const __m256i special =
+        _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\\')));
+    return _mm256_andnot_si256(special, printable);
+}
+
+template <__m256i (*Mask)(__m256i)>
+MAYBE_TARGET_AVX2 const char* scan_avx2(const char* p)
+{
+    for (;;) {
+        const __m256i c = _mm256_loadu_si256((const __m256i*)p);
+        const uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(Mask(c));
+        if (stop)
+            return p + count_trailing_zeros(stop);
+        p += 32;
+    }
+}
+
+static const ScanKernels c_avx2_kernels = {
+    "avx2", scan_avx2<identifier_mask_avx2>,
+    scan_avx2<inline_wspace_mask_avx2>, scan_avx2<comment_mask_avx2>,
+    scan_avx2<literal_mask_avx2>};
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 1);
+    const bool osxsave = (r[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6)  // OS saves the YMM registers
+        return false;
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // MAYBE_SIMDSCAN_X86
+
+vector<const ScanKernels*> available_scan_kernels()
+{
+    vector<const ScanKernels*> result{&c_scalar_kernels};
+#ifdef MAYBE_SIMDSCAN_X86
+    result.push_back(&c_sse2_kernels);
+    if (cpu_has_avx2())
+        result.push_back(&c_avx2_kernels);
+#endif
+    return result;
+}
+
+const ScanKernels& best_scan_kernels()
+{
+    static const ScanKernels* best = available_scan_kernels().back();
+    return *best;
+}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "std.h"
+#include "consts.h"
+
+namespace maybe {
+
+// Scanning kernels for the tokenizer's hot loops. A kernel returns the first
+// char from `p` which is not in its class. They don't take the end of the
+// buffer: like the FileReader buffers, the chars must be followed by at least
+// c_scan_max_width NUL chars (which are in none of the classes) so the vector
+// loads never read past them.
+using ScanFn = const char* (*)(const char* p);
+
+static const int c_scan_max_width = 32;  // widest vector load (AVX2)
+static_assert(c_filereader_lookahead >= c_scan_max_width,
+              "the FileReader sentinel must cover a vector load");
+
+struct ScanKernels
+{
+    const char* name;
+    ScanFn identifier;     // [A-Za-z0-9]
+    ScanFn inline_wspace;  // SPACE, TAB
+    // chars allowed in comments, stops at the newline, too
+    ScanFn comment;
+    // chars copied as they are in interpreted string literals, stops at the
+    // quote, the backslash and control chars
+    ScanFn literal;
+};
+
+// Kernels for the best instruction set supported by the CPU (AVX2, SSE2 or
+// the scalar fallback), detected on the first call.
+const ScanKernels& best_scan_kernels();
+
+// All kernels which can run on this CPU, scalar first.
+vector<const ScanKernels*> available_scan_kernels();
+}
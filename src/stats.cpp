@@ -0,0 +1,201 @@
+#include "stats.h"
+
+#include <chrono>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "log.h"
+
+namespace maybe {
+
+Stats stats;
+
+static const char* const c_phase_names[c_num_phases] = {
+    "read",  "tokenize", "implicit tokens", "print tokens",
+    "parse", "cache",    "emit"};
+static const char* const c_counter_names[c_num_counters] = {
+    "files",       "bytes read",   "refills",    "tokens",
+    "token FIFO high-water",       "AST nodes",  "errors",
+    "cache hits",  "cache misses", "cache write errors"};
+static const char* const c_token_kind_names[c_num_token_kinds] = {
+    "eof", "word", "wspace", "number", "string", "implicit", "error"};
+
+void Stats::update_max(Counter c, int64_t n)
+{
+    auto& x = counters[(int)c];
+    int64_t prev = x.load(std::memory_order_relaxed);
+    while (prev < n &&
+           !x.compare_exchange_weak(prev, n, std::memory_order_relaxed)) {
+    }
+}
+
+using Clock = std::chrono::steady_clock;
+static const Clock::time_point c_process_start = Clock::now();
+
+static int64_t wall_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now() - c_process_start)
+        .count();
+}
+
+// CPU time of the current thread
+static int64_t cpu_ns()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    auto ticks = [](const FILETIME& ft) {
+        return (int64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 100;  // 100 ns ticks
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// the innermost PhaseTimer running on the thread
+static thread_local PhaseTimer* current_timer = nullptr;
+
+void PhaseTimer::start()
+{
+    started = true;
+    parent = current_timer;
+    current_timer = this;
+    wall_begin = wall_ns();
+    cpu_begin = cpu_ns();
+}
+
+void PhaseTimer::stop()
+{
+    const int64_t wall = wall_ns() - wall_begin;
+    const int64_t cpu = cpu_ns() - cpu_begin;
+    const int ix = (int)phase;
+    stats.phase_wall_ns[ix].fetch_add(wall - nested_wall,
+                                      std::memory_order_relaxed);
+    stats.phase_cpu_ns[ix].fetch_add(cpu - nested_cpu,
+                                     std::memory_order_relaxed);
+    assert(current_timer == this);
+    current_timer = parent;
+    if (parent) {
+        parent->nested_wall += wall;
+        parent->nested_cpu += cpu;
+    }
+}
+
+struct TraceEvent
+{
+    string name;
+    const char* category;
+    int tid;
+    int64_t begin_us, duration_us;
+};
+
+static std::mutex trace_mutex;
+static vector<TraceEvent> trace_events;
+static std::atomic<int> next_trace_tid{1};
+static thread_local int trace_tid = 0;
+
+TraceSpan::TraceSpan(string name, const char* category)
+    : name(move(name)), category(category)
+{
+    if (globals.trace)
+        begin_us = wall_ns() / 1000;
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!globals.trace)
+        return;
+    const int64_t end_us = wall_ns() / 1000;
+    if (!trace_tid)
+        trace_tid = next_trace_tid++;
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_events.push_back(TraceEvent{move(name), category, trace_tid,
+                                      begin_us, end_us - begin_us});
+}
+
+static string json_escaped(string_par s)
+{
+    string r;
+    for (const char* p = s.c_str(); *p; ++p) {
+        const char c = *p;
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        } else if ((uint8_t)c < 0x20) {
+            r += fmt::format("\\u{:04x}", (int)c);
+        } else {
+            r += c;
+        }
+    }
+    return r;
+}
+
+bool write_trace(string_par filename)
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    string s = "{\"traceEvents\":[";
+    for (auto& e : trace_events) {
+        if (&e != trace_events.data())
+            s += ",";
+        s += fmt::format(
+            "\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{},"
+            "\"dur\":{},\"pid\":1,\"tid\":{}}}",
+            json_escaped(e.name), e.category, e.begin_us, e.duration_us,
+            e.tid);
+    }
+    s += "\n]}\n";
+    FILE* f = nowide::fopen(filename.c_str(), "wb");
+    if (!f)
+        return false;
+    const bool ok = fwrite(s.data(), 1, s.size(), f) == s.size();
+    return fclose(f) == 0 && ok;
+}
+
+void print_stats()
+{
+    string s;
+    for (int i = 0; i < c_num_counters; ++i)
+        s += fmt::format("{}: stats: {}: {}\n", c_program_name,
+                         c_counter_names[i], stats.counters[i].load());
+    string kinds;
+    for (int i = 0; i < c_num_token_kinds; ++i)
+        kinds += fmt::format("{}{} {}", i ? ", " : "", c_token_kind_names[i],
+                             stats.tokens_by_kind[i].load());
+    s += fmt::format("{}: stats: tokens by kind: {}\n", c_program_name, kinds);
+    write_stderr(s);
+}
+
+void print_time_report()
+{
+    string s = fmt::format(
+        "{}: time report (self times summed over the threads)\n"
+        "{:<20}{:>12}{:>12}\n",
+        c_program_name, "phase", "wall ms", "cpu ms");
+    int64_t wall_total = 0, cpu_total = 0;
+    for (int i = 0; i < c_num_phases; ++i) {
+        const int64_t wall = stats.phase_wall_ns[i].load();
+        const int64_t cpu = stats.phase_cpu_ns[i].load();
+        wall_total += wall;
+        cpu_total += cpu;
+        s += fmt::format("{:<20}{:>12.3f}{:>12.3f}\n", c_phase_names[i],
+                         wall / 1e6, cpu / 1e6);
+    }
+    s += fmt::format("{:<20}{:>12.3f}{:>12.3f}\n", "total", wall_total / 1e6,
+                     cpu_total / 1e6);
+    s += fmt::format("{:<20}{:>12.3f}\n", "elapsed", wall_ns() / 1e6);
+    write_stderr(s);
+    print_stats();
+}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+
+#include "std.h"
+#include "utils.h"
+
+#include "globals.h"
+#include "token.h"
+
+namespace maybe {
+
+// Phases of the front end, see PhaseTimer.
+enum class Phase
+{
+    read,  // opening the files and the buffered reads
+    tokenize,
+    implicit_tokens,
+    print_tokens,
+    parse,
+    cache,
+    emit,  // serializing and writing the binary results
+};
+static const int c_num_phases = 7;
+
+enum class Counter
+{
+    files,
+    bytes_read,
+    refills,  // of the FileReader buffer
+    tokens,   // passed to the parser, see Stats::tokens_by_kind
+    token_fifo_high_water,  // the most tokens in a TokenFifo (max)
+    ast_nodes,
+    errors,  // reported in the source files
+    cache_hits,
+    cache_misses,
+    cache_write_errors,
+};
+static const int c_num_counters = 10;
+static const int c_num_token_kinds = Token::error + 1;
+
+// Counters and phase times of the compilation, summed from the worker
+// threads. Printed with --stats and --time-report. The times are collected
+// only if globals.time_phases.
+struct Stats
+{
+    void add(Counter c, int64_t n = 1)
+    {
+        counters[(int)c].fetch_add(n, std::memory_order_relaxed);
+    }
+    void update_max(Counter c, int64_t n);
+    int64_t get(Counter c) const { return counters[(int)c].load(); }
+
+    std::atomic<int64_t> counters[c_num_counters];
+    std::atomic<int64_t> tokens_by_kind[c_num_token_kinds];
+    // self times: without the phases nested in them
+    std::atomic<int64_t> phase_wall_ns[c_num_phases];
+    std::atomic<int64_t> phase_cpu_ns[c_num_phases];
+};
+
+// zero-initialized, it's global
+extern Stats stats;
+
+// Adds the wall and the CPU time of the current thread while in scope to a
+// phase. The pipeline stages pull from each other so phases nest: the time
+// of a nested phase is subtracted from the enclosing one.
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(Phase phase) : phase(phase)
+    {
+        if (UL_UNLIKELY(globals.time_phases))
+            start();
+    }
+    ~PhaseTimer()
+    {
+        if (UL_UNLIKELY(started))
+            stop();
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    void operator=(const PhaseTimer&) = delete;
+
+private:
+    void start();
+    void stop();
+
+    const Phase phase;
+    bool started = false;
+    PhaseTimer* parent = nullptr;
+    int64_t wall_begin = 0, cpu_begin = 0;
+    int64_t nested_wall = 0, nested_cpu = 0;
+};
+
+// Pipeline stage timing the stage `Source` as `phase`.
+template <class Source>
+class TimedStage
+{
+public:
+    TimedStage(Source& source, Phase phase) : source(source), phase(phase) {}
+    int fill(span<Token> out)
+    {
+        PhaseTimer timer(phase);
+        return source.fill(out);
+    }
+
+private:
+    Source& source;
+    const Phase phase;
+};
+
+// Records a span for --trace (if globals.trace) while in scope.
+class TraceSpan
+{
+public:
+    TraceSpan(string name, const char* category);
+    ~TraceSpan();
+    TraceSpan(const TraceSpan&) = delete;
+    void operator=(const TraceSpan&) = delete;
+
+private:
+    string name;
+    const char* category;
+    int64_t begin_us = 0;
+};
+
+void print_stats();
+void print_time_report();
+// Write the spans recorded in the Chrome trace event format (JSON). False on
+// error.
+bool write_trace(string_par filename);
+}
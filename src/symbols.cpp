@@ -0,0 +1,116 @@
+#include "symbols.h"
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace maybe {
+
+// in the order of the enumerators
+static const char* const c_predefined_symbols[] = {
+    "fn", "if", "else", "while", "return", "cast", "+",  "-",  "*",
+    "/",  "=",  "==",   "!=",    "<",      "<=",   ">",  ">=", "&&",
+    "||", "->", ".",    "#",     "(",      ")",    "[",  "]",  "{",
+    "}",  ";",  ":",    ","};
+
+static_assert(sizeof(c_predefined_symbols) / sizeof(c_predefined_symbols[0]) ==
+                  c_num_predefined_symbols,
+              "c_predefined_symbols doesn't match the Symbol enum");
+
+// The strings are stored in fixed-size chunks which are never reallocated so
+// symbol_str() can return a reference and read it without locking.
+class SymbolTable
+{
+public:
+    SymbolTable()
+    {
+        for (auto s : c_predefined_symbols)
+            intern(s);
+        // single chars are looked up without locking
+        for (int c = 0x21; c < 0x7f; ++c) {
+            const char ch = (char)c;
+            single_chars[c] = intern(std::string_view(&ch, 1));
+        }
+    }
+
+    Symbol intern(std::string_view s)
+    {
+        if (s.size() == 1 && single_chars[(uint8_t)s[0]] != c_no_symbol)
+            return single_chars[(uint8_t)s[0]];
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            auto it = ids.find(s);
+            if (it != ids.end())
+                return it->second;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        auto it = ids.find(s);  // may have been added since the lookup
+        if (it != ids.end())
+            return it->second;
+        const auto ix = size;
+        const auto chunk_ix = ix >> c_symbol_chunk_bits;
+        CHECK(chunk_ix < c_max_symbol_chunks, "Too many symbols.");
+        Chunk* chunk = chunks[chunk_ix].load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new Chunk;
+            chunks[chunk_ix].store(chunk, std::memory_order_release);
+        }
+        string& str = (*chunk)[ix & c_symbol_chunk_mask];
+        str.assign(s.data(), s.size());
+        ++size;
+        ids.emplace(std::string_view(str), (Symbol)ix);
+        return (Symbol)ix;
+    }
+
+    const string& str(Symbol s) const
+    {
+        // The Symbol was published after its string had been stored.
+        const Chunk* chunk =
+            chunks[s >> c_symbol_chunk_bits].load(std::memory_order_acquire);
+        assert(chunk && s < c_symbol_chunk_size * c_max_symbol_chunks);
+        return (*chunk)[s & c_symbol_chunk_mask];
+    }
+
+private:
+    static const int c_symbol_chunk_bits = 12;
+    static const uint32_t c_symbol_chunk_size = 1u << c_symbol_chunk_bits;
+    static const uint32_t c_symbol_chunk_mask = c_symbol_chunk_size - 1;
+    static const int c_max_symbol_chunks = 4096;  // 16M symbols
+    static const Symbol c_no_symbol = (Symbol)UINT32_MAX;
+
+    using Chunk = array<string, c_symbol_chunk_size>;
+
+    // never deleted, the table lives until the end of the program
+    array<std::atomic<Chunk*>, c_max_symbol_chunks> chunks{};
+    uint32_t size = 0;
+    std::shared_mutex mutex;
+    // the keys point into the chunks
+    std::unordered_map<std::string_view, Symbol> ids;
+    array<Symbol, 256> single_chars = make_single_chars();
+
+    static array<Symbol, 256> make_single_chars()
+    {
+        array<Symbol, 256> a;
+        a.fill(c_no_symbol);
+        return a;
+    }
+};
+
+static SymbolTable& symbol_table()
+{
+    static SymbolTable* table = new SymbolTable;  // never destroyed, see above
+    return *table;
+}
+
+Symbol intern_symbol(const char* b, const char* e)
+{
+    return symbol_table().intern(std::string_view(b, e - b));
+}
+
+const string& symbol_str(Symbol s)
+{
+    return symbol_table().str(s);
+}
+}
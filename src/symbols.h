@@ -0,0 +1,61 @@
+#pragma once
+
+#include "std.h"
+
+namespace maybe {
+
+// Interned identifier, operator or separator. The global symbol table gives
+// equal strings the same Symbol so they can be compared as integers and
+// stored in tokens without allocation. Interning is thread-safe and a
+// Symbol's string never moves or dies.
+//
+// The enumerators are interned in this order when the table is created, the
+// interned strings get the values after them.
+enum Symbol : uint32_t
+{
+    // keywords
+    sym_fn,
+    sym_if,
+    sym_else,
+    sym_while,
+    sym_return,
+    sym_cast,
+    // operators
+    sym_plus,
+    sym_minus,
+    sym_star,
+    sym_slash,
+    sym_assign,
+    sym_eq,
+    sym_ne,
+    sym_lt,
+    sym_le,
+    sym_gt,
+    sym_ge,
+    sym_and,
+    sym_or,
+    sym_arrow,
+    sym_dot,
+    sym_hash,
+    // separators
+    sym_lparen,
+    sym_rparen,
+    sym_lbracket,
+    sym_rbracket,
+    sym_lbrace,
+    sym_rbrace,
+    sym_semicolon,
+    sym_colon,
+    sym_comma,
+
+    c_num_predefined_symbols
+};
+
+Symbol intern_symbol(const char* b, const char* e);
+inline Symbol intern_symbol(const string& s)
+{
+    return intern_symbol(s.data(), s.data() + s.size());
+}
+
+const string& symbol_str(Symbol s);
+}
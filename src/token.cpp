@@ -0,0 +1,259 @@
+#include "token.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "charclass.h"
+
+#include "fmt/format.h"
+
+namespace maybe {
+
+Token TokenPayloads::new_number(int col, int length, Nonnegative value)
+{
+    // most numbers are small integers, they don't need the table
+    if (holds_alternative<uint64_t>(value) &&
+        get<uint64_t>(value) <= UINT32_MAX) {
+        return Token{Token::number, number_inline, 0, col, length,
+                     (uint32_t)get<uint64_t>(value)};
+    }
+    numbers.emplace_back(value);
+    return Token{Token::number, number_in_table, 0, col, length,
+                 (uint32_t)(numbers.size() - 1)};
+}
+
+Token TokenPayloads::new_string_literal(int col,
+                                        int length,
+                                        cspan raw,
+                                        bool has_escapes)
+{
+    strings.emplace_back(raw);
+    return Token{Token::string_literal, has_escapes, 0, col, length,
+                 (uint32_t)(strings.size() - 1)};
+}
+
+Token TokenPayloads::new_string_literal_copy(int col,
+                                             int length,
+                                             string raw,
+                                             bool has_escapes)
+{
+    string_copies.emplace_back(make_unique<string>(move(raw)));
+    const auto& s = *string_copies.back();
+    return new_string_literal(col, length, make_span(s.data(), s.size()),
+                              has_escapes);
+}
+
+Token TokenPayloads::new_error(ErrorInSourceFile e)
+{
+    const auto ix = std::min<size_t>(errors.size(), c_max_errors - 1);
+    const Token t{Token::error, 0,        (uint16_t)ix,
+                  e.col,        e.length, (uint32_t)e.line_num};
+    if (errors.size() < c_max_errors - 1) {
+        errors.emplace_back(move(e));
+    } else if (errors.size() == c_max_errors - 1) {
+        e.msg =
+            fmt::format("Too many errors (more than {}).", c_max_errors - 1);
+        errors.emplace_back(move(e));
+    }
+    return t;
+}
+
+Token TokenPayloads::add_token_from(const TokenPayloads& from,
+                                    Token t,
+                                    int line_offset,
+                                    ptrdiff_t chars_offset)
+{
+    assert(from.string_copies.empty());
+    switch (t.kind) {
+        case Token::number:
+            if (t.sub == number_in_table) {
+                numbers.emplace_back(from.numbers[t.data]);
+                t.data = numbers.size() - 1;
+            }
+            break;
+        case Token::string_literal: {
+            const auto raw = from.strings[t.data];
+            strings.emplace_back(
+                make_span(raw.data() + chars_offset, raw.size()));
+            t.data = strings.size() - 1;
+        } break;
+        case Token::error: {
+            auto e = from.errors[t.aux];
+            e.line_num += line_offset;
+            return new_error(move(e));
+        }
+        case Token::wspace:
+            if (!t.inline_wspace())
+                t.data += line_offset;
+            break;
+        case Token::implicit:
+        case Token::eof:
+            t.data += line_offset;
+            break;
+        case Token::word:
+            break;
+    }
+    return t;
+}
+
+void TokenPayloads::count_payload(const Token& t, TableSizes& sizes)
+{
+    switch (t.kind) {
+        case Token::number:
+            sizes.numbers += t.sub == number_in_table;
+            break;
+        case Token::string_literal:
+            ++sizes.strings;
+            break;
+        case Token::error:
+            ++sizes.errors;
+            break;
+        default:
+            break;
+    }
+}
+
+Token TokenPayloads::shifted(Token t,
+                             const TableSizes& index_offset,
+                             int line_offset)
+{
+    switch (t.kind) {
+        case Token::number:
+            if (t.sub == number_in_table)
+                t.data += index_offset.numbers;
+            break;
+        case Token::string_literal:
+            t.data += index_offset.strings;
+            break;
+        case Token::error:
+            t.aux += index_offset.errors;
+            t.data += line_offset;
+            break;
+        case Token::wspace:
+            if (!t.inline_wspace())
+                t.data += line_offset;
+            break;
+        case Token::implicit:
+        case Token::eof:
+            t.data += line_offset;
+            break;
+        case Token::word:
+            break;
+    }
+    return t;
+}
+
+Nonnegative TokenPayloads::number(const Token& t) const
+{
+    assert(t.kind == Token::number);
+    if (t.sub == number_inline)
+        return Nonnegative{uint64_t{t.data}};
+    return numbers[t.data];
+}
+
+string TokenPayloads::string_literal(const Token& t) const
+{
+    const auto raw = raw_string_literal(t);
+    if (!t.string_literal_has_escapes())
+        return string(raw.begin(), raw.end());
+    // the Tokenizer has validated the escape sequences
+    string s;
+    s.reserve(raw.size());
+    const char* p = raw.data();
+    const char* e = p + raw.size();
+    while (const char* q = (const char*)memchr(p, '\\', e - p)) {
+        assert(q + 1 < e && has_char_class(q[1], cc_escape));
+        s.append(p, q);
+        s += c_escape_table[(uint8_t)q[1]];
+        p = q + 2;
+    }
+    s.append(p, e);
+    return s;
+}
+
+TokenFifo::TokenFifo(int capacity)
+    : tokens(new Token[capacity]), mask(capacity - 1)
+{
+    CHECK(capacity > 0 && (capacity & mask) == 0,
+          "TokenFifo capacity must be a power of two");
+}
+
+void TokenFifo::grow()
+{
+    const int new_capacity = 2 * capacity();
+    uptr<Token[]> new_tokens(new Token[new_capacity]);
+    for (int i = 0; i < count; ++i)
+        new_tokens[i] = at(i);
+    tokens = move(new_tokens);
+    mask = new_capacity - 1;
+    head = 0;
+}
+
+Maybe<int> maybe_line_num(const Token& t)
+{
+    switch (t.kind) {
+        case Token::implicit:
+        case Token::eof:
+        case Token::error:
+            return t.line_num();
+        case Token::wspace:
+            if (!t.inline_wspace())
+                return t.line_num();
+            return Nothing;
+        default:
+            return Nothing;
+    }
+}
+
+bool same_token(const Token& x,
+                const TokenPayloads& xp,
+                const Token& y,
+                const TokenPayloads& yp)
+{
+    if (x != y)
+        return false;
+    switch (x.kind) {
+        case Token::number:
+            return xp.number(x) == yp.number(y);
+        case Token::string_literal:
+            return xp.string_literal(x) == yp.string_literal(y);
+        case Token::error: {
+            const auto &xe = xp.error(x), &ye = yp.error(y);
+            return xe.msg == ye.msg && xe.line_num == ye.line_num &&
+                   xe.col == ye.col && xe.length == ye.length;
+        }
+        default:
+            return true;
+    }
+}
+
+string to_string(const Token& x, const TokenPayloads& payloads)
+{
+    switch (x.kind) {
+        case Token::eof:
+            return "<EOF>";
+        case Token::word:
+            return "<Word:" + symbol_str(x.symbol()) + ">";
+        case Token::wspace:
+            return "<WSPC>";
+        case Token::number:
+            return "#";
+        case Token::string_literal:
+            return "\"" + payloads.string_literal(x) + "\"";
+        case Token::implicit:
+            switch (x.implicit_kind()) {
+                case Token::sequencing:
+                    return "<Impl;>";
+                case Token::begin_block:
+                    return "<Impl{>";
+                case Token::end_block:
+                    return "<Impl}>";
+            }
+            break;
+        case Token::error:
+            return "<Error:" + payloads.error(x).msg + ">";
+    }
+    CHECK(false);
+    return "<internal error>";
+}
+}
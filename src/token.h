@@ -0,0 +1,310 @@
+#pragma once
+
+#include "std.h"
+#include "utils.h"
+
+#include "consts.h"
+#include "symbols.h"
+
+namespace maybe {
+
+using Nonnegative = variant<uint64_t, long double>;
+
+// A token packed into 16 bytes. It's trivially copyable: the numbers, string
+// literals and errors which don't fit are stored in the TokenPayloads of the
+// file and the token holds their index.
+struct Token
+{
+    enum Kind : uint8_t
+    {
+        eof,
+        word,
+        wspace,
+        number,
+        string_literal,
+        implicit,
+        error,
+    };
+    enum WordKind : uint8_t
+    {
+        identifier,
+        operator_,
+        separator,
+        other
+    };
+    enum ImplicitKind : uint8_t
+    {
+        sequencing,
+        begin_block,
+        end_block,
+    };
+
+    static Token new_eof(int col, int line_num, bool aborted_due_to_error)
+    {
+        return Token{eof, aborted_due_to_error, 0, col, 1, (uint32_t)line_num};
+    }
+    static Token new_word(int col, int length, WordKind kind, Symbol symbol)
+    {
+        return Token{word, kind, 0, col, length, symbol};
+    }
+    // whitespace between lines, the indentation of line `line_num`
+    static Token new_indent(int col,
+                            int length,
+                            int line_num,
+                            int indent_level)
+    {
+        assert(line_num > 0 && 0 <= indent_level &&
+               indent_level <= c_max_indent_level);
+        return Token{wspace, 0,      (uint16_t)indent_level,
+                     col,    length, (uint32_t)line_num};
+    }
+    static Token new_inline_wspace(int col, int length)
+    {
+        return Token{wspace, 0, 0, col, length, 0};
+    }
+    static Token new_implicit(int col, int line_num, ImplicitKind kind)
+    {
+        return Token{implicit, kind, 0, col, 0, (uint32_t)line_num};
+    }
+    // numbers, string literals and errors are created by TokenPayloads
+
+    WordKind word_kind() const
+    {
+        assert(kind == word);
+        return (WordKind)sub;
+    }
+    Symbol symbol() const
+    {
+        assert(kind == word);
+        return (Symbol)data;
+    }
+    ImplicitKind implicit_kind() const
+    {
+        assert(kind == implicit);
+        return (ImplicitKind)sub;
+    }
+    bool inline_wspace() const
+    {
+        assert(kind == wspace);
+        return data == 0;
+    }
+    // valid for whitespace between lines
+    int indent_level() const
+    {
+        assert(kind == wspace);
+        return aux;
+    }
+    // The raw chars of the string literal contain escape sequences, see
+    // TokenPayloads::string_literal().
+    bool string_literal_has_escapes() const
+    {
+        assert(kind == string_literal);
+        return sub != 0;
+    }
+    bool aborted_due_to_error() const
+    {
+        assert(kind == eof);
+        return sub != 0;
+    }
+    // 0 for inline whitespace
+    int line_num() const
+    {
+        assert(kind == wspace || kind == implicit || kind == eof ||
+               kind == error);
+        return data;
+    }
+
+    static const int c_max_indent_level = UINT16_MAX;
+
+    Kind kind;
+    // WordKind, ImplicitKind, aborted_due_to_error (eof),
+    // string_literal_has_escapes or the representation of a number, see
+    // TokenPayloads
+    uint8_t sub;
+    uint16_t aux;  // indent level (wspace), payload index (error)
+    int col, length;
+    // line number (wspace, implicit, eof, error), Symbol (word), payload
+    // index or value (number, string_literal)
+    uint32_t data;
+};
+
+inline bool operator==(const Token& x, const Token& y)
+{
+    return x.kind == y.kind && x.sub == y.sub && x.aux == y.aux &&
+           x.col == y.col && x.length == y.length && x.data == y.data;
+}
+inline bool operator!=(const Token& x, const Token& y)
+{
+    return !(x == y);
+}
+
+static_assert(sizeof(Token) <= 16, "Token should fit in 16 bytes");
+static_assert(std::is_trivially_copyable<Token>::value,
+              "Token should be trivially copyable");
+
+// Side tables of the tokens of a file, for the payloads which don't fit in a
+// Token. Indices are assigned in the order the tokens are created.
+//
+// String literals are stored raw, as they are between the quotes in the
+// source, and unescaped only on request. The raw chars of a mapped file are
+// referenced in place so the payloads must not outlive the FileReader.
+struct TokenPayloads
+{
+    Token new_number(int col, int length, Nonnegative value);
+    // `raw` must stay valid while the payloads are used (see
+    // FileReader::mapped_span())
+    Token new_string_literal(int col,
+                             int length,
+                             cspan raw,
+                             bool has_escapes);
+    // same but `raw` is stored in the payloads
+    Token new_string_literal_copy(int col,
+                                  int length,
+                                  string raw,
+                                  bool has_escapes);
+    // Past c_max_errors all errors share the last slot, which then reports
+    // the error limit.
+    Token new_error(ErrorInSourceFile e);
+
+    Nonnegative number(const Token& t) const;
+    // the string literal with the escape sequences resolved
+    string string_literal(const Token& t) const;
+    cspan raw_string_literal(const Token& t) const
+    {
+        assert(t.kind == Token::string_literal);
+        return strings[t.data];
+    }
+    const ErrorInSourceFile& error(const Token& t) const
+    {
+        assert(t.kind == Token::error);
+        return errors[t.aux];
+    }
+
+    static const int c_max_errors = UINT16_MAX + 1;  // Token::aux
+
+    vector<Nonnegative> numbers;
+    vector<cspan> strings;  // raw
+    vector<ErrorInSourceFile> errors;
+    // chars of the copied string literals, the strings must not move
+    vector<uptr<string>> string_copies;
+
+    // The sizes of the tables: the indices of the next payloads.
+    struct TableSizes
+    {
+        int numbers = 0, strings = 0, errors = 0;
+    };
+    TableSizes table_sizes() const
+    {
+        return TableSizes{(int)numbers.size(), (int)strings.size(),
+                          (int)errors.size()};
+    }
+    // The number token `t` holds the index of its value in `numbers`, not
+    // the value.
+    static bool is_number_in_table(const Token& t)
+    {
+        assert(t.kind == Token::number);
+        return t.sub == number_in_table;
+    }
+    // Count the payload of `t` (if it has one) in `sizes`.
+    static void count_payload(const Token& t, TableSizes& sizes);
+    // `t` with its payload indices shifted by `index_offset` and its line
+    // number by `line_offset`, for splicing the tables (the line numbers of
+    // the errors in the table are not shifted).
+    static Token shifted(Token t,
+                         const TableSizes& index_offset,
+                         int line_offset);
+
+    // Add the token `t` of `from` with its payload, shifting its line number
+    // by `line_offset` and its raw string literal by `chars_offset` (if the
+    // source chars have moved). For merging the tokens of the parts of a
+    // file. The string literals of `from` must be in place, not copies.
+    Token add_token_from(const TokenPayloads& from,
+                         Token t,
+                         int line_offset,
+                         ptrdiff_t chars_offset = 0);
+
+private:
+    // Token::sub for numbers
+    enum NumberRepr : uint8_t
+    {
+        number_inline,  // value in Token::data
+        number_in_table
+    };
+};
+
+// FIFO of tokens in a power-of-two ring buffer, no allocation per token.
+// The capacity doubles when the buffer is full which is rare: the readers
+// keep only a few tokens in it. Growing moves the tokens so push_back
+// invalidates the references to the tokens in the FIFO.
+class TokenFifo
+{
+public:
+    TokenFifo() : TokenFifo(c_token_fifo_initial_capacity) {}
+    explicit TokenFifo(int capacity);
+
+    const Token& front() const
+    {
+        assert(!empty());
+        return tokens[head];
+    }
+    Token& front()
+    {
+        assert(!empty());
+        return tokens[head];
+    }
+    const Token& at(int ix) const
+    {
+        assert(0 <= ix && ix < size());
+        return tokens[(head + ix) & mask];
+    }
+    int size() const { return count; }
+    int capacity() const { return mask + 1; }
+    void pop_front()
+    {
+        assert(!empty());
+        head = (head + 1) & mask;
+        --count;
+    }
+    void push_back(const Token& t)
+    {
+        if (UL_UNLIKELY(count > mask))
+            grow();
+        tokens[(head + count) & mask] = t;
+        ++count;
+        if (UL_UNLIKELY(count > max_count))
+            max_count = count;
+    }
+    bool empty() const { return count == 0; }
+    void clear() { head = count = 0; }
+    // the most tokens the FIFO has held
+    int high_water() const { return max_count; }
+
+private:
+    void grow();
+
+    uptr<Token[]> tokens;
+    int mask;  // capacity - 1
+    int head = 0;
+    int count = 0;
+    int max_count = 0;
+};
+
+inline int col(const Token& t)
+{
+    return t.col;
+}
+inline int length(const Token& t)
+{
+    return t.length;
+}
+Maybe<int> maybe_line_num(const Token& t);
+
+// True if the tokens are the same with the same payloads, `x` of `xp` and `y`
+// of `yp`.
+bool same_token(const Token& x,
+                const TokenPayloads& xp,
+                const Token& y,
+                const TokenPayloads& yp);
+
+string to_string(const Token& x, const TokenPayloads& payloads);
+}
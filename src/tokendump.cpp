@@ -0,0 +1,148 @@
+#include "tokendump.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "charclass.h"
+#include "log.h"
+
+namespace maybe {
+
+// of "%Lf": the digits of the largest long double, the sign, the point, 6
+// decimals and the NUL
+static const int c_max_real_chars =
+    std::numeric_limits<long double>::max_exponent10 + 16;
+static const char c_spaces[] =
+    "                                                                ";
+
+TokenDumpWriter::TokenDumpWriter(const TokenPayloads& payloads, Sink sink)
+    : payloads(payloads), sink(sink)
+{
+}
+
+void TokenDumpWriter::flush()
+{
+    if (buf.size() == 0)
+        return;
+    if (sink)
+        sink(buf.data(), buf.size());
+    else
+        write_stdout(buf.data(), buf.size());
+    buf.clear();
+}
+
+void TokenDumpWriter::write(const Token& t)
+{
+    switch (t.kind) {
+        case Token::wspace:
+            if (t.inline_wspace()) {
+                append(" ");
+            } else {
+                // the line number zero-padded to 4 digits, then the indent
+                const fmt::format_int line(t.line_num());
+                append("\n");
+                if (line.size() < 4)
+                    append("0000", 4 - line.size());
+                append(line.data(), line.size());
+                for (int n = t.indent_level(); n > 0;) {
+                    const int k = std::min<int>(n, sizeof(c_spaces) - 1);
+                    append(c_spaces, k);
+                    n -= k;
+                }
+            }
+            break;
+        case Token::word: {
+            const auto& name = symbol_str(t.symbol());
+            append("<");
+            append(name.data(), name.size());
+            append(">");
+        } break;
+        case Token::number: {
+            append("#");
+            const auto x = payloads.number(t);
+            if (holds_alternative<uint64_t>(x)) {
+                const fmt::format_int s(get<uint64_t>(x));
+                append(s.data(), s.size());
+            } else {
+                // %Lf like std::to_string(), in place
+                const size_t size = buf.size();
+                buf.resize(size + c_max_real_chars);
+                const int n = snprintf(buf.data() + size, c_max_real_chars,
+                                       "%Lf", get<long double>(x));
+                buf.resize(size + std::max(n, 0));
+            }
+        } break;
+        case Token::string_literal:
+            write_string_literal(payloads.raw_string_literal(t),
+                                 t.string_literal_has_escapes());
+            break;
+        case Token::error: {
+            const auto& x = payloads.error(t);
+            auto out = std::back_inserter(buf);
+            if (x.has_location()) {
+                fmt::format_to(out, "ERROR in {}: {}:{}:{}:{}\n", x.filename,
+                               x.msg, x.line_num, x.col, x.length);
+            } else {
+                fmt::format_to(out, "ERROR in {}: {}\n", x.filename, x.msg);
+            }
+        } break;
+        case Token::eof:
+            append("<EOF>\n");
+            break;
+        case Token::implicit:
+            switch (t.implicit_kind()) {
+                case Token::sequencing:
+                    append("\n$;");
+                    break;
+                case Token::begin_block:
+                    append("\n${");
+                    break;
+                case Token::end_block:
+                    append("\n$}");
+                    break;
+                default:
+                    CHECK(false);
+            }
+            break;
+    }
+}
+
+// The string literal with the escape sequences resolved (like
+// TokenPayloads::string_literal() but without the temporary string) between
+// quotes. The runs of printable chars are copied, the other chars are
+// written as \xNN.
+void TokenDumpWriter::write_string_literal(cspan raw, bool has_escapes)
+{
+    static const char c_hex_digits[] = "0123456789abcdef";
+    const char stop = has_escapes ? '\\' : 0;
+    append("\"");
+    const char* p = raw.data();
+    const char* e = p + raw.size();
+    while (p < e) {
+        const char* q = p;
+        while (q < e && *q != stop && isprint((uint8_t)*q))
+            ++q;
+        append(p, q - p);
+        if (q == e)
+            break;
+        char c = *q++;
+        if (has_escapes && c == '\\') {
+            // the Tokenizer has validated the escape sequences
+            assert(q < e && has_char_class(*q, cc_escape));
+            c = c_escape_table[(uint8_t)*q++];
+        }
+        if (isprint((uint8_t)c)) {
+            append(&c, 1);
+        } else {
+            const char x[4] = {'\\', 'x', c_hex_digits[(uint8_t)c >> 4],
+                               c_hex_digits[(uint8_t)c & 15]};
+            append(x, 4);
+        }
+        p = q;
+    }
+    append("\"");
+}
+}
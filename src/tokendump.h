@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstring>
+
+#include "std.h"
+#include "utils.h"
+
+#include "fmt/format.h"
+
+#include "token.h"
+
+namespace maybe {
+
+// Writes the text dump of tokens (--dump-tokens). The tokens are formatted
+// into a reusable buffer which is passed to the sink in blocks of about
+// c_token_dump_block_size chars, not a write per token.
+class TokenDumpWriter
+{
+public:
+    using Sink = void (*)(const char* s, size_t size);
+
+    // the default sink is write_stdout()
+    explicit TokenDumpWriter(const TokenPayloads& payloads,
+                             Sink sink = nullptr);
+    ~TokenDumpWriter() { flush(); }
+    TokenDumpWriter(const TokenDumpWriter&) = delete;
+    void operator=(const TokenDumpWriter&) = delete;
+
+    void write(span<const Token> tokens)
+    {
+        for (auto& t : tokens)
+            write(t);
+        if (buf.size() >= c_token_dump_block_size)
+            flush();
+    }
+    void flush();
+
+private:
+    void write(const Token& t);
+    void write_string_literal(cspan raw, bool has_escapes);
+    void append(const char* s, size_t size)
+    {
+        const size_t n = buf.size();
+        buf.resize(n + size);
+        memcpy(buf.data() + n, s, size);
+    }
+    template <size_t N>
+    void append(const char (&s)[N])
+    {
+        append(s, N - 1);
+    }
+
+    const TokenPayloads& payloads;
+    Sink sink;
+    fmt::memory_buffer buf;
+};
+}
@@ -6,36 +6,73 @@
 #include "tokenizer.h"
 
 namespace maybe {
-class TokenImplicitInserter
+
+// The part of TokenImplicitInserter which doesn't depend on the source.
+class TokenImplicitInserterBase
+{
+protected:
+    // True for the tokens which are passed on as they are.
+    static bool passes_through(const Token& t)
+    {
+        switch (t.kind) {
+            case Token::wspace:
+                return t.inline_wspace();
+            case Token::eof:
+            case Token::implicit:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    // Push the implicit tokens replacing the whitespace at the beginning of a
+    // line, or the pending end_block tokens and the eof token to fifo.
+    void insert_implicit_tokens(const Token& t);
+
+    IndentBlocks blocks;
+    TokenFifo fifo;
+};
+
+// Pipeline stage (see TokenBatchSource) which replaces the whitespace at the
+// beginning of the lines with implicit sequencing, begin_block and end_block
+// tokens. The Tokenizer can also insert them itself, see
+// Tokenizer::Tokenizer.
+template <class Source>
+class TokenImplicitInserter : TokenImplicitInserterBase
 {
 public:
-    TokenImplicitInserter(TokenSource&& token_source)
-        : token_source(token_source)
+    explicit TokenImplicitInserter(Source& source) : source(source) {}
+
+    int fill(span<Token> out)
     {
-        stack.reserve(c_begin_end_token_inserter_initial_stack_capacity);
-        stack.push_back(Item{1, 1, 0, region_indent_block});
+        int n = 0;
+        while (n < out.size()) {
+            if (UL_UNLIKELY(!fifo.empty())) {
+                out[n++] = fifo.front();
+                fifo.pop_front();
+                continue;
+            }
+            if (UL_UNLIKELY(in_next == in_end)) {
+                in_end = source.fill(make_span(in.data(), in.size()));
+                in_next = 0;
+                if (in_end == 0)
+                    break;
+            }
+            const Token& t = in[in_next++];
+            if (UL_LIKELY(passes_through(t)))
+                out[n++] = t;
+            else
+                insert_implicit_tokens(t);
+        }
+        return n;
     }
 
-    Token& get_next_token();
+    // see TokenFifo::high_water()
+    int fifo_high_water() const { return fifo.high_water(); }
 
 private:
-    enum Region
-    {
-        region_paren,
-        region_bracket,
-        region_brace_block,
-        region_indent_block
-    };
-    struct Item
-    {
-        int line_num;
-        int col;
-        int indent_level;
-        Region region;
-    };
-
-    TokenSource token_source;
-    vector<Item> stack;
-    TokenFifo fifo;
+    Source& source;
+    array<Token, c_tokenizer_batch_size> in;
+    int in_next = 0, in_end = 0;
 };
 }
@@ -1,132 +1,165 @@
 #include "tokenizer.h"
 
+#include <algorithm>
 #include <cmath>
 #include <climits>
 
 #include "consts.h"
+#include "charclass.h"
+#include "numberliteral.h"
 
 #include "fmt/printf.h"
 
 namespace maybe {
 
-Token& Tokenizer::get_next_token()
+int Tokenizer::fill(span<Token> out)
 {
-    if (UL_LIKELY(!fifo.empty()))
-        fifo.pop_front();
-    if (UL_UNLIKELY(fifo.empty()))
-        load_at_least(c_tokenizer_batch_size);
-
-    return fifo.front();
-}
-
-void Tokenizer::load_at_least(int n)
-{
-    while (UL_LIKELY(fifo.size() < n && !had_eof)) {
+    // read_next() reads one or more tokens to the FIFO
+    int n = 0;
+    for (;;) {
+        while (!fifo.empty() && n < out.size()) {
+            out[n++] = fifo.front();
+            fifo.pop_front();
+        }
+        if (n == out.size() || had_eof)
+            return n;
         read_next();
     }
 }
 
 void Tokenizer::read_next()
 {
-    if (UL_UNLIKELY(line_num == 0))
+    if (UL_UNLIKELY(!started)) {
+        started = true;
         start_reading_line_skip_empty_lines();
-    else if (UL_LIKELY(!had_eof))
+    } else if (UL_LIKELY(!had_eof)) {
         continue_reading_line();
+    }
 }
 
 void Tokenizer::eof_reached(bool aborted_due_to_error)
 {
-    if (!aborted_due_to_error && !fr.is_eof()) {
-        emplace_error("can't read file",
-                      fr.chars_read() - current_line_start_pos, 1);
+    if (!aborted_due_to_error) {
+        if (UL_UNLIKELY(fr.has_invalid_utf8())) {
+            // the chars end where the invalid sequence begins
+            emplace_error("Invalid UTF-8 sequence", cur_col() + 1, 1);
+            aborted_due_to_error = true;
+        } else if (!fr.is_eof()) {
+            emplace_error("can't read file",
+                          fr.chars_read() - current_line_start_pos, 1);
+        }
     }
     had_eof = true;
-    fifo.emplace_back<TokenEof>(cur_col(), 1, aborted_due_to_error);
+    if (insert_implicit_tokens)
+        blocks.eof(cur_col(), line_num, fifo);
+    fifo.push_back(Token::new_eof(cur_col(), line_num, aborted_due_to_error));
+}
+
+void Tokenizer::end_of_part_reached()
+{
+    had_eof = had_end_of_part = true;
+    fifo.push_back(Token::new_eof(cur_col(), line_num, false));
 }
 
 void Tokenizer::emplace_error(string_par msg, int tok_col, int length)
 {
-    fifo.emplace_back<ErrorInSourceFile>(filename, msg.str(), line_num, tok_col,
-                                         length);
+    fifo.push_back(payloads.new_error(ErrorInSourceFile{
+        filename, msg.str(), line_num, tok_col, length}));
 }
 
 inline bool is_ucnzc(char c)
 {
     // TODO use unicode chars and return if not in Z? or C?
-    return (0x20 <= c && c <= 0x7f) || (c & 0x80);
+    return has_char_class(c, cc_ucnzc);
 }
 
-inline bool is_allowed_char_in_comments(char c)
+// Advance fr to where scan(fr.cursor()) stops, appending the chars skipped
+// to *collector if not null. The scan must stop at NUL: the sentinel after
+// the buffered chars stops it so it needs no end-of-buffer check.
+template <class Scan>
+void skip_scanned(FileReader& fr, Scan scan, string* collector = nullptr)
 {
-    return is_ucnzc(c) || c == ' '  // TODO: instead of space, test for Zs
-           || c == c_ascii_tab;     // TODO: also allow Cf|Cs
+    for (;;) {
+        const char* b = fr.cursor();
+        const char* e = scan(b);
+        if (collector)
+            collector->append(b, e);
+        fr.advance_to(e);
+        if (e < fr.buf_end() || !fr.refill())
+            return;
+    }
+}
+
+// Advance fr while pred(c) holds, pred('\0') must be false.
+template <class Pred>
+void skip_while(FileReader& fr, Pred pred, string* collector = nullptr)
+{
+    skip_scanned(fr,
+                 [pred](const char* p) {
+                     while (pred(*p))
+                         ++p;
+                     return p;
+                 },
+                 collector);
 }
 
 bool Tokenizer::try_read_from_inline_comment_after_first_char_read(char c)
 {
-    if (UL_LIKELY(c != c_token_inline_comment[0]))
+    if (UL_LIKELY(c != c_lang_inline_comment[0]))
         return false;
-    auto maybe_c = fr.peek_next_char();
-    static_assert(c_token_inline_comment.size() == 2, "");
-    if (UL_LIKELY(!maybe_c || *maybe_c != c_token_inline_comment[1]))
+    static_assert(c_lang_inline_comment.size() == 2, "");
+    if (UL_LIKELY(fr.peek() != c_lang_inline_comment[1]))
         return false;
 
     fr.advance();
     // read until eol
-    for (;;) {
-        maybe_c = fr.next_char();
-        if (UL_UNLIKELY(!maybe_c)) {
-            eof_reached(false);
-            return true;
-        }
-        if (UL_UNLIKELY(try_read_eol_after_first_char_read(*maybe_c))) {
-            start_reading_line_skip_empty_lines();
-            return true;
-        }
-        if (UL_UNLIKELY(!is_allowed_char_in_comments(*maybe_c))) {
-            emplace_error(
-                fmt::sprintf("Invalid character in inline comment: 0x%02x",
-                             (uint8_t)*maybe_c),
-                fr.chars_read(), 1);
-            eof_reached(true);
-            return true;
-        }
+    skip_scanned(fr, scan.comment);
+    auto maybe_c = fr.next_char();
+    if (UL_UNLIKELY(!maybe_c)) {
+        eof_reached(false);
+        return true;
+    }
+    if (UL_LIKELY(try_read_eol_after_first_char_read(*maybe_c))) {
+        start_reading_line_skip_empty_lines();
+        return true;
     }
-    assert(false);  // unreachable
+    emplace_error(fmt::sprintf("Invalid character in inline comment: 0x%02x",
+                               (uint8_t)*maybe_c),
+                  cur_col(), 1);
+    eof_reached(true);
+    return true;
 }
 
 void Tokenizer::start_reading_line_skip_empty_lines()
 {
     current_line_start_pos = fr.chars_read();
     ++line_num;
-
-    auto maybe_c = fr.peek_next_char();
+    if (UL_UNLIKELY(fr.cursor() == end_of_part)) {
+        end_of_part_reached();
+        return;
+    }
 
     // Test if line begins with shell comment token
-    if (UL_UNLIKELY(maybe_c && maybe_c == c_token_shell_comment)) {
+    if (UL_UNLIKELY(fr.peek() == c_token_shell_comment)) {
         fr.advance();
         // read until EOL
-        for (;;) {
-            maybe_c = fr.next_char();
-            if (UL_UNLIKELY(!maybe_c)) {
-                eof_reached(false);
-                return;
-            }
-            if (UL_UNLIKELY(try_read_eol_after_first_char_read(*maybe_c))) {
-                // tail-recurse
-                start_reading_line_skip_empty_lines();
-                return;
-            }
-            if (UL_UNLIKELY(!is_allowed_char_in_comments(*maybe_c))) {
-                emplace_error(
-                    fmt::sprintf("Invalid character in shell comment: 0x%02x",
-                                 (uint8_t)*maybe_c),
-                    fr.chars_read(), 1);
-                eof_reached(true);
-                return;
-            }
+        skip_scanned(fr, scan.comment);
+        auto maybe_c = fr.next_char();
+        if (UL_UNLIKELY(!maybe_c)) {
+            eof_reached(false);
+            return;
+        }
+        if (UL_LIKELY(try_read_eol_after_first_char_read(*maybe_c))) {
+            // tail-recurse
+            start_reading_line_skip_empty_lines();
+            return;
         }
-        assert(false);  // unreachable
+        emplace_error(
+            fmt::sprintf("Invalid character in shell comment: 0x%02x",
+                         (uint8_t)*maybe_c),
+            cur_col(), 1);
+        eof_reached(true);
+        return;
     }
 
     // read an empty or normal line
@@ -165,7 +198,7 @@ void Tokenizer::start_reading_line_skip_empty_lines()
     // We're after the (possibly none) indentation
     // Continue with newline, inline comment or ucnzc char
     // It can't be eof, we should have detected it above
-    maybe_c = fr.next_char();
+    auto maybe_c = fr.next_char();
     assert(maybe_c);
 
     // test newline
@@ -184,247 +217,143 @@ void Tokenizer::start_reading_line_skip_empty_lines()
     if (UL_UNLIKELY(!is_ucnzc(*maybe_c))) {
         emplace_error(
             fmt::sprintf("Invalid character: 0x%02x", (uint8_t)*maybe_c),
-            fr.chars_read(), 1);
+            cur_col(), 1);
         eof_reached(true);
         return;
     }
 
-    fifo.emplace_back<TokenWspace>(1, cur_col(), line_num, level);
+    if (UL_UNLIKELY(level > Token::c_max_indent_level)) {
+        emplace_error("Indentation is too deep", 1, level);
+        eof_reached(true);
+        return;
+    }
 
-    continue_reading_line(*maybe_c);
-}
+    if (insert_implicit_tokens)
+        blocks.line_start(1, line_num, level, fifo);
+    else
+        fifo.push_back(Token::new_indent(1, cur_col(), line_num, level));
 
-inline bool iswspace_but_not_newline(char c)
-{
-    return iswspace(c) && !(c == c_ascii_CR || c == c_ascii_LF);
+    continue_reading_line(*maybe_c);
 }
 
-void Tokenizer::read_token_identifier(int tok_col, string collector)
+void Tokenizer::read_token_identifier(int tok_col, char first_char)
 {
     // [alpha][alnum]* sequence
     // go until not alnum
-    for (;;) {
-        auto maybe_c = fr.peek_next_char();
-        if (maybe_c && isalnum(*maybe_c)) {
-            collector += *maybe_c;
-            fr.advance();
-        } else
-            break;
+    const char* b = fr.cursor();
+    const char* e = scan.identifier(b);
+    // The first char is normally still right before the cursor (unless a peek
+    // refilled the buffer since), then the identifier is interned from the
+    // buffer without copying.
+    if (UL_LIKELY(e < fr.buf_end() && b[-1] == first_char)) {
+        fr.advance_to(e);
+        const Symbol symbol = intern_symbol(b - 1, e);
+        fifo.push_back(Token::new_word(tok_col, cur_col() - tok_col,
+                                       Token::identifier, symbol));
+    } else {
+        read_token_identifier(tok_col, string(1, first_char));
     }
-    fifo.emplace_back<TokenWord>(tok_col, cur_col() - tok_col,
-                                 TokenWord::identifier, move(collector));
 }
 
-// Call this after "0x" has been read
-// Reads and adds a TokenUnsigned, or, if there are no hex digits right after
-// "0x"
-// adds a TokenUnsigned with zero value and reads a suffix (TokenIdentifier)
-// interpreting
-// the x_char as the first character of the suffix.
-void Tokenizer::read_hex_literal(int tok_col, char x_char)
+// `collector` holds the chars of the identifier already read
+void Tokenizer::read_token_identifier(int tok_col, string collector)
 {
-    // read until hex digits
-    uint64_t hexnumber = 0;
-    bool too_long = false;
-    for (;;) {
-        int digit;
-        auto maybe_c = fr.peek_next_char();
-        if (UL_LIKELY(maybe_c)) {
-            char c = *maybe_c;
-            if ('0' <= c && c <= 9) {
-                digit = c - '0';
-            } else if ('a' <= c && c <= 'f') {
-                digit = c - 'a';
-            } else if ('A' <= c && c <= 'F') {
-                digit = c - 'A';
-            } else
-                break;
-            fr.advance();
-            if (UL_UNLIKELY((hexnumber & 0xf000000000000000) != 0)) {
-                too_long = true;
-                break;
-            }
-            hexnumber = (hexnumber << 4) | (uint64_t)digit;
-        } else
-            break;
-    }
-    // Read either zero, some or too much digits
-    int length = fr.chars_read() - current_line_start_pos - tok_col;
-    if (UL_UNLIKELY(length <= 2)) {
-        CHECK(length == 2);  // "0x"
-        // add '0' TokenUnsigned and start new token with *maybe_x
-        fifo.emplace_back<TokenNumber>(tok_col, 1, uint64_t{0});
-        read_token_identifier(tok_col + 1, string(1, x_char));
-        return;
-    }
-    if (UL_UNLIKELY(too_long)) {
-        fifo.emplace_back<ErrorInSourceFile>(
-            filename, "hex literal exceeds 8 bytes", line_num, tok_col, length);
-    }
-
-    fifo.emplace_back<TokenNumber>(tok_col, length, uint64_t{0});
+    skip_scanned(fr, scan.identifier, &collector);
+    fifo.push_back(Token::new_word(tok_col, cur_col() - tok_col,
+                                   Token::identifier,
+                                   intern_symbol(collector)));
 }
 
-// the input nneg_literal is the part of number already read,
-// e.g. the very first digit of the number
-Nonnegative read_number(FileReader& fr, Nonnegative nneg_literal)
+// Call this after "0x" has been read. Adds the number or, if there are no hex
+// digits after "0x", a zero and an identifier starting with `x_char`.
+void Tokenizer::read_hex_literal(int tok_col, char x_char)
 {
-    for (;;) {
-        auto maybe_c = fr.peek_next_char();
-        if (!maybe_c || !isdigit(*maybe_c))
-            break;
-        fr.advance();
-        uint64_t digit = *maybe_c - '0';
-        if (UL_LIKELY(holds_alternative<uint64_t>(nneg_literal))) {
-            auto& x = get<uint64_t>(nneg_literal);
-            if (UL_LIKELY(x <= (UINT64_MAX - digit) / 10)) {
-                x = 10 * x + digit;
-            } else {
-                nneg_literal = (long double)10 * x + digit;
-            }
-        } else {
-            auto& x = get<long double>(nneg_literal);
-            x = 10 * x + digit;
+    uint64_t value = 0;
+    int num_digits = 0;
+    int num_significant_digits = 0;  // after the leading zeros
+    skip_scanned(fr, [&](const char* p) {
+        for (; has_char_class(*p, cc_hex_digit); ++p) {
+            ++num_digits;
+            const int d = hex_digit_value(*p);
+            if (value == 0 && d == 0)
+                continue;
+            if (++num_significant_digits <= 16)
+                value = (value << 4) | (uint64_t)d;
         }
+        return p;
+    });
+    if (UL_UNLIKELY(num_digits == 0)) {
+        fifo.push_back(payloads.new_number(tok_col, 1, uint64_t{0}));
+        read_token_identifier(tok_col + 1, x_char);
+        return;
     }
-    return nneg_literal;
-}
-
-long double Tokenizer::read_fractional()
-{
-    strtmp.assign(1, '.');
-    for (;;) {
-        auto maybe_c = fr.peek_next_char();
-        if (!maybe_c || !isdigit(*maybe_c))
-            break;
-        fr.advance();
-        strtmp += *maybe_c;
+    if (UL_UNLIKELY(num_significant_digits > 16)) {
+        emplace_error("hex literal exceeds 8 bytes", tok_col,
+                      cur_col() - tok_col);
+        return;
     }
-    char* str_end = nullptr;
-    long double y = strtold(strtmp.c_str(), &str_end);
-    CHECK(str_end != strtmp && y != HUGE_VALL);
-    return y;
-}
-
-long double to_long_double(Nonnegative x)
-{
-    if (holds_alternative<uint64_t>(x))
-        return (long double)get<uint64_t>(x);
-    else
-        return get<long double>(x);
+    fifo.push_back(payloads.new_number(tok_col, cur_col() - tok_col, value));
 }
 
-string to_string(const Nonnegative& x)
+// Pass the digits to add_digit() while there are digits.
+template <class AddDigit>
+void read_digits(FileReader& fr, AddDigit add_digit)
 {
-    if (holds_alternative<uint64_t>(x))
-        return fmt::format("{}", get<uint64_t>(x));
-    else
-        return fmt::format("{}", get<long double>(x));
+    skip_scanned(fr, [&add_digit](const char* p) {
+        for (; has_char_class(*p, cc_digit); ++p)
+            add_digit(*p - '0');
+        return p;
+    });
 }
 
+// Reads [0-9]+(\.[0-9]*)?([eE][+-]?[0-9]+)? or a hex literal. The 'e' is not
+// part of the number if no exponent digits follow it.
 void Tokenizer::read_token_number(int tok_col, char first_char_digit)
 {
-    // sequence of digits
     if (UL_UNLIKELY(first_char_digit == '0')) {
         // can be a hex constant
-        auto maybe_x = fr.peek_next_char();
-        if (maybe_x && (*maybe_x == 'x' || *maybe_x == 'X')) {
+        char x = fr.peek();
+        if (x == 'x' || x == 'X') {
             fr.advance();
-            read_hex_literal(tok_col, *maybe_x);
+            read_hex_literal(tok_col, x);
             return;
         }
     }
-    // not hexdigit, read digit seq
-    // we have already read a digit, pass it to nat reader which
-    // reads the rest
-    auto nneg_literal = Nonnegative{(uint64_t)(first_char_digit - '0')};
-    nneg_literal = read_number(fr, nneg_literal);
-    auto maybe_c = fr.peek_next_char();
-    string suffix;  // collect chars here we ate but found invalid
-                    // later
-    if (UL_LIKELY(maybe_c)) {
-        if (*maybe_c == '.') {
-            fr.advance();
-            long double fractional = read_fractional();
-            if (fractional != 0.0L)
-                nneg_literal = to_long_double(nneg_literal) + fractional;
-            maybe_c = fr.peek_next_char();
-        }
-        if (*maybe_c == 'e' || *maybe_c == 'E') {
-            // at this point we ate 'e' or 'E'
-            fr.advance();
-            suffix += *maybe_c;
-            maybe_c = fr.peek_next_char();
-            if (UL_LIKELY(maybe_c)) {
-                char sign_char = 0;
-                if (*maybe_c == '+' || *maybe_c == '-') {
-                    sign_char = *maybe_c;
-                    fr.advance();
-                    suffix += sign_char;
-                    maybe_c = fr.peek_next_char();
-                }
-                // at this point we ate 'e|E' and
-                // - either ate '+|-' and peeked next
-                // - or peeked next which is not '+|-'
-                if (maybe_c && isdigit(*maybe_c)) {
-                    // this is the only branch where we found a
-                    // valid
-                    // scientific notation double literal
-                    fr.advance();
-                    long double mantissa = to_long_double(nneg_literal);
-                    auto nl_exponent = read_number(
-                        fr, Nonnegative{(uint64_t)(*maybe_c - '0')});
-                    if (UL_UNLIKELY(
-                            holds_alternative<long double>(nl_exponent))) {
-                        fifo.emplace_back<ErrorInSourceFile>(
-                            filename, "exponent is too high", line_num, tok_col,
-                            fr.chars_read() - current_line_start_pos - tok_col);
-                        return;
-                    }
-                    uint64_t u_exponent = get<uint64_t>(nl_exponent);
-                    if (u_exponent >= INT_MAX) {
-                        fifo.emplace_back<ErrorInSourceFile>(
-                            filename, "exponent is too high", line_num, tok_col,
-                            fr.chars_read() - current_line_start_pos - tok_col);
-                        return;
-                    }
-                    int exponent = (int)u_exponent;
-                    if (sign_char == '-')
-                        exponent = -exponent;
-                    long double x = mantissa * pow(10.0L, exponent);
-                    long double int_x;
-                    auto frac_x = std::modf(x, &int_x);
-                    if (frac_x == 0.0L && x <= (long double)UINT64_MAX) {
-                        nneg_literal = (uint64_t)x;
-                    } else {
-                        nneg_literal = (long double)x;
-                    }
-                }
+    DecimalLiteral lit;
+    lit.add_digit(first_char_digit - '0');
+    read_digits(fr, [&lit](int d) { lit.add_digit(d); });
+    char c = fr.peek();
+    if (c == '.') {
+        fr.advance();
+        read_digits(fr, [&lit](int d) { lit.add_fraction_digit(d); });
+        c = fr.peek();
+    }
+    if (c == 'e' || c == 'E') {
+        const char sign_char = fr.peek(1);
+        const int num_digits_at = sign_char == '+' || sign_char == '-' ? 2 : 1;
+        if (has_char_class(fr.peek(num_digits_at), cc_digit)) {
+            for (int i = 0; i < num_digits_at; ++i)
+                fr.advance();
+            int64_t exponent = 0;  // saturates at INT_MAX
+            read_digits(fr, [&exponent](int d) {
+                exponent = std::min<int64_t>(10 * exponent + d, INT_MAX);
+            });
+            if (exponent >= INT_MAX) {
+                emplace_error("exponent is too high", tok_col,
+                              cur_col() - tok_col);
+                return;
             }
+            lit.set_exponent(sign_char == '-' ? -(int)exponent
+                                              : (int)exponent);
         }
     }
-
-    if (holds_alternative<uint64_t>(nneg_literal)) {
-        fifo.emplace_back<TokenNumber>(tok_col, cur_col() - tok_col,
-                                       nneg_literal);
-    } else {
-        long double x = get<long double>(nneg_literal);
-        if (std::isnan(x)) {
-            fifo.emplace_back<ErrorInSourceFile>(
-                filename, "invalid number", line_num, tok_col,
-                fr.chars_read() - current_line_start_pos - tok_col);
-            return;
-        } else if (std::isinf(x)) {
-            fifo.emplace_back<ErrorInSourceFile>(
-                filename, "number overflow", line_num, tok_col,
-                fr.chars_read() - current_line_start_pos - tok_col);
-            return;
-        } else {
-            fifo.emplace_back<TokenNumber>(tok_col, cur_col() - tok_col, x);
-        }
+    const Nonnegative value = lit.value();
+    if (holds_alternative<long double>(value) &&
+        std::isinf(get<long double>(value))) {
+        emplace_error("number overflow", tok_col, cur_col() - tok_col);
+        return;
     }
-    if (!suffix.empty())
-        read_token_identifier(fr.chars_read() - suffix.size(), move(suffix));
+    fifo.push_back(payloads.new_number(tok_col, cur_col() - tok_col, value));
 }
 
 void Tokenizer::continue_reading_line()
@@ -441,12 +370,8 @@ bool Tokenizer::try_read_eol_after_first_char_read(char c)
 {
     if (UL_UNLIKELY(c == c_ascii_CR)) {
         // also accepts CR without LF
-        auto maybe_c = fr.peek_next_char();
-        if (!maybe_c)
-            return true;  // CR, then EOF
-        if (*maybe_c == c_ascii_LF) {
+        if (fr.peek() == c_ascii_LF)
             fr.advance();  // CRLF
-        }
         return true;
     } else
         return c == c_ascii_LF;
@@ -454,66 +379,98 @@ bool Tokenizer::try_read_eol_after_first_char_read(char c)
 
 inline bool is_inline_wspace(char c)
 {
-    return c == c_ascii_tab || c == ' ';
+    return has_char_class(c, cc_inline_wspace);
 }
 
 inline bool is_operator(char c)
 {
-    for (const char* p = &c_token_operators[0]; *p; ++p) {
-        if (*p == c)
-            return true;
-    }
-    return false;
-}
-inline bool is_separator(char c)
-{
-    for (const char* p = &c_token_separators[0]; *p; ++p) {
-        if (*p == c)
-            return true;
-    }
-    return false;
+    return has_char_class(c, cc_operator);
 }
 
-// call this after reading the backslash
-Maybe<char> Tokenizer::maybe_resolve_escape_sequence_in_interpreted_literal()
+// Call this after reading the backslash. Returns the char after it if the
+// escape sequence is valid, otherwise reports the error and the eof.
+Maybe<char> Tokenizer::read_escape_sequence_in_interpreted_literal()
 {
     auto maybe_c = fr.next_char();
     if (!maybe_c) {
-        emplace_error("End-of-file in interpreted string literal",
-                      fr.chars_read() - current_line_start_pos, 1);
+        if (!fr.has_invalid_utf8())
+            emplace_error("End-of-file in interpreted string literal",
+                          fr.chars_read() - current_line_start_pos, 1);
         eof_reached(false);
         return Nothing;
     }
-    Maybe<char> result;
-    if (*maybe_c != '\'') {
-        for (const char* p = &c_tokenizer_escape_sequences[0]; *p; ++p) {
-            if (*p == *maybe_c) {
-                auto idx = p - &c_tokenizer_escape_sequences[0];
-                result = c_tokenizer_resolved_espace_sequences[idx];
-                break;
-            }
-        }
+    if (UL_LIKELY(has_char_class(*maybe_c, cc_escape)))
+        return maybe_c;
+    if (isprint(*maybe_c)) {
+        emplace_error(
+            fmt::sprintf("Invalid escape sequence: \"\\%c\"", *maybe_c),
+            fr.chars_read() - current_line_start_pos, 1);
+    } else {
+        emplace_error(
+            fmt::sprintf(
+                "Invalid escape sequence: raw char \\x%02x after backslash",
+                *maybe_c),
+            fr.chars_read() - current_line_start_pos, 1);
     }
-    if (!result) {
-        if (isprint(*maybe_c)) {
-            emplace_error(
-                fmt::sprintf("Invalid escape sequence: \"\\%c\"", *maybe_c),
-                fr.chars_read() - current_line_start_pos, 1);
-        } else {
-            emplace_error(
-                fmt::sprintf(
-                    "Invalid escape sequence: raw char \\x%02x after backslash",
-                    *maybe_c),
-                fr.chars_read() - current_line_start_pos, 1);
+    eof_reached(true);
+    return Nothing;
+}
+
+// Call this after the opening quote. The literal is stored raw, the escape
+// sequences are only validated here. The raw chars of a mapped file are
+// referenced in place, otherwise they're collected while the buffer is
+// still valid.
+void Tokenizer::read_string_literal(int tok_col)
+{
+    const bool in_place = fr.is_mapped();
+    const char* raw_begin = fr.cursor();
+    string raw;
+    bool has_escapes = false;
+    for (;;) {
+        skip_scanned(fr, scan.literal, in_place ? nullptr : &raw);
+        auto maybe_c = fr.next_char();
+        if (!maybe_c) {
+            if (!fr.has_invalid_utf8())
+                emplace_error("End-of-file in interpreted string literal",
+                              fr.chars_read() - current_line_start_pos, 1);
+            eof_reached(false);
+            return;
+        } else if (*maybe_c == '"') {
+            break;
+        } else if (*maybe_c != '\\') {
+            emplace_error(fmt::sprintf("Invalid raw character in "
+                                       "interpreted string literal: \\x%02x",
+                                       *maybe_c),
+                          fr.chars_read() - current_line_start_pos, 1);
+            eof_reached(false);
+            return;
         }
-        eof_reached(false);
+        auto maybe_escaped_char =
+            read_escape_sequence_in_interpreted_literal();
+        if (!maybe_escaped_char)
+            return;
+        has_escapes = true;
+        if (!in_place) {
+            raw += '\\';
+            raw += *maybe_escaped_char;
+        }
+    }
+    const int length = cur_col() - tok_col;
+    if (in_place) {
+        // before the closing quote
+        fifo.push_back(payloads.new_string_literal(
+            tok_col, length, make_span(raw_begin, fr.cursor() - 1),
+            has_escapes));
+    } else {
+        fifo.push_back(payloads.new_string_literal_copy(
+            tok_col, length, move(raw), has_escapes));
     }
-    return result;
 }
 
 void Tokenizer::continue_reading_line(char c)
 {
-    if (try_read_eol_after_first_char_read(c)) {
+    const auto cc = c_char_classes[(uint8_t)c];
+    if (UL_UNLIKELY(cc & cc_newline) && try_read_eol_after_first_char_read(c)) {
         // tail-recurse
         start_reading_line_skip_empty_lines();
         return;
@@ -523,14 +480,10 @@ void Tokenizer::continue_reading_line(char c)
 
     // Following can be: <inline-wspace>+, inline comment or ucnzc
 
-    if (is_inline_wspace(c)) {
+    if (cc & cc_inline_wspace) {
         // whitespace sequence
-        Maybe<char> maybe_c;
-        for (;;) {
-            maybe_c = fr.next_char();
-            if (!maybe_c || !is_inline_wspace(*maybe_c))
-                break;
-        }
+        skip_scanned(fr, scan.inline_wspace);
+        auto maybe_c = fr.next_char();
         if (!maybe_c) {
             eof_reached(false);
             return;
@@ -544,159 +497,50 @@ void Tokenizer::continue_reading_line(char c)
         }
         if (try_read_from_inline_comment_after_first_char_read(c))
             return;
-        fifo.emplace_back<TokenWspace>(tok_col, cur_col() - tok_col, 0, 0);
+        fifo.push_back(Token::new_inline_wspace(tok_col, cur_col() - tok_col));
         continue_reading_line(*maybe_c);  // tail-recurse
         return;
     }
 
-    if (UL_UNLIKELY(try_read_from_inline_comment_after_first_char_read(c)))
+    if (UL_UNLIKELY(cc & cc_comment_start) &&
+        try_read_from_inline_comment_after_first_char_read(c))
         return;
 
-    if (UL_UNLIKELY(!is_ucnzc(c))) {
+    if (UL_UNLIKELY(!(cc & cc_ucnzc))) {
         emplace_error(fmt::sprintf("Invalid character: 0x%02x", (uint8_t)c),
-                      fr.chars_read() - current_line_start_pos - tok_col, 1);
+                      tok_col, 1);
         eof_reached(true);
         return;
     }
 
-    if (isalpha(c)) {
+    if (cc & cc_alpha) {
         // [alpha][alnum]* sequence
-        read_token_identifier(tok_col, string(1, c));
-    } else if (isdigit(c)) {
+        read_token_identifier(tok_col, c);
+    } else if (cc & cc_digit) {
         read_token_number(tok_col, c);
         return;
     } else if (c == '"') {
         // interpreted string literal
-        string w;
-        for (;;) {
-            auto maybe_c = fr.next_char();
-            if (!maybe_c) {
-                emplace_error("End-of-file in interpreted string literal",
-                              fr.chars_read() - current_line_start_pos, 1);
-                eof_reached(false);
-                return;
-            } else if (*maybe_c < 32) {
-                emplace_error(
-                    fmt::sprintf("Invalid raw character in "
-                                 "interpreted string literal: \\x%02x",
-                                 *maybe_c),
-                    fr.chars_read() - current_line_start_pos, 1);
-                eof_reached(false);
-                return;
-            }
-            if (*maybe_c == '"') {
-                break;
-            } else if (*maybe_c == '\\') {
-                auto maybe_escaped_char =
-                    maybe_resolve_escape_sequence_in_interpreted_literal();
-                if (!maybe_escaped_char) {
-                    eof_reached(true);
-                    return;
-                }
-                w += *maybe_escaped_char;
-            } else {
-                w += *maybe_c;
-            }
-        }
-        fifo.emplace_back<TokenStringLiteral>(tok_col, cur_col() - tok_col,
-                                              move(w));
-    } else if (is_separator(c)) {
-        fifo.emplace_back<TokenWord>(tok_col, cur_col() - tok_col,
-                                     TokenWord::separator, string(1, c));
-    } else if (is_operator(c)) {
+        read_string_literal(tok_col);
+    } else if (cc & cc_separator) {
+        fifo.push_back(Token::new_word(tok_col, cur_col() - tok_col,
+                                       Token::separator,
+                                       intern_symbol(&c, &c + 1)));
+    } else if (cc & cc_operator) {
+        string w(1, c);
+        skip_while(fr, is_operator, &w);
+        fifo.push_back(Token::new_word(tok_col, cur_col() - tok_col,
+                                       Token::operator_, intern_symbol(w)));
+    } else {
+        // a single char or a whole multibyte sequence, the FileReader has
+        // validated it
         string w(1, c);
-        for (;;) {
-            auto maybe_c = fr.peek_next_char();
-            if (!maybe_c || !is_operator(*maybe_c))
-                break;
-            w += *maybe_c;
+        for (int n = utf8_sequence_length(c); n > 1; --n) {
+            w += fr.peek();
             fr.advance();
         }
-        fifo.emplace_back<TokenWord>(tok_col, cur_col() - tok_col,
-                                     TokenWord::operator_, move(w));
-    } else {
-        fifo.emplace_back<TokenWord>(tok_col, cur_col() - tok_col,
-                                     TokenWord::other, string(1, c));
-    }
-}
-
-string to_string(const TokenWspace&)
-{
-    return "<WSPC>";
-}
-
-string to_string(const TokenImplicit& x)
-{
-    switch (x.kind) {
-        case TokenImplicit::sequencing:
-            return "<Impl;>";
-        case TokenImplicit::begin_block:
-            return "<Impl{>";
-        case TokenImplicit::end_block:
-            return "<Impl}>";
-        default:
-            CHECK(false);
-            return "<internal error>";
+        fifo.push_back(Token::new_word(tok_col, cur_col() - tok_col,
+                                       Token::other, intern_symbol(w)));
     }
 }
-
-string to_string(const TokenEof&)
-{
-    return "<EOF>";
-}
-
-string to_string(const TokenWord& x)
-{
-    return "<Word:" + x.s + ">";
-}
-string to_string(const TokenStringLiteral& x)
-{
-    return "\"" + x.s + "\"";
-}
-string to_string(const TokenNumber&)
-{
-    return "#";
-}
-string to_string(const Token& x)
-{
-    return visit([](auto&& sx) -> string { return to_string(sx); }, x);
-}
-
-int col(const Token& t)
-{
-    return visit([](auto&& x) -> int { return x.col; }, t);
-}
-
-int length(const Token& t)
-{
-    return visit(
-        [](auto&& x) -> int {
-            if
-                constexpr(VISITED_VARIANT_IS(x, TokenImplicit)) return 0;
-            else
-                return x.length;
-        },
-        t);
-}
-Maybe<int> maybe_line_num(const Token& t)
-{
-    Maybe<int> result;
-    BEGIN_VISIT_VARIANT_WITH(x)
-    if
-        constexpr(VISITED_VARIANT_IS(x, TokenImplicit) ||
-                  VISITED_VARIANT_IS(x, TokenEof) ||
-                  VISITED_VARIANT_IS(x, ErrorInSourceFile))
-        {
-            result = x.line_num;
-        }
-    else if
-        constexpr(VISITED_VARIANT_IS(x, TokenWspace))
-        {
-            if (!x.inline_())
-                result = x.line_num;
-        }
-
-    END_VISIT_VARIANT(t)
-    return result;
-}
 }
@@ -4,168 +4,118 @@
 #include "utils.h"
 
 #include "filereader.h"
+#include "simdscan.h"
+#include "indentblocks.h"
 
 namespace maybe {
 
-struct TokenWspace
-{
-    bool inline_() const { return line_num == 0; }
-    int col, length;
-    int line_num;      // 0 for inline whitespace, > 0 for whitespace between
-                       // lines
-    int indent_level;  // valid if line_num > 0
-};
-
-struct TokenImplicit
+struct Tokenizer
 {
-    enum Kind
+    // filename is for error msgs
+    // If `insert_implicit_tokens` the Tokenizer emits the implicit tokens
+    // itself instead of the whitespace at the beginning of the lines, like
+    // the Tokenizer -> TokenImplicitInserter pipeline, without the extra
+    // stage.
+    Tokenizer(FileReader& fr,
+              string filename,
+              bool insert_implicit_tokens = false)
+        : fr(fr),
+          filename(move(filename)),
+          scan(best_scan_kernels()),
+          insert_implicit_tokens(insert_implicit_tokens)
     {
-        sequencing,
-        begin_block,
-        end_block,
-    };
-    int col;
-    int line_num;
-    Kind kind;
-};
+    }
 
-struct TokenEof
-{
-    int col, length;
-    int line_num;
-    bool aborted_due_to_error;
-};
+    // Stage interface, see TokenBatchSource.
+    int fill(span<Token> out);
+    void read_next();
 
-struct TokenWord
-{
-    enum Kind
+    // For tokenizing a part of a file (see ChunkedTokenizer): stop at `end`,
+    // which must be at the beginning of a line, and emit the eof token there
+    // without the end-of-file checks.
+    void set_end_of_part(const char* end)
     {
-        identifier,
-        operator_,
-        separator,
-        other
-    };
-
-    int col, length;
-    Kind kind;
-    string s;
-};
-
-struct TokenStringLiteral
-{
-    int col, length;
-    string s;
-};
-
-using Nonnegative = variant<uint64_t, long double>;
-
-struct TokenNumber
-{
-    int col, length;
-    Nonnegative value;
-};
-
-string to_string(const TokenWspace& x);
-string to_string(const TokenImplicit& x);
-string to_string(const TokenEof& x);
-string to_string(const TokenWord& x);
-string to_string(const TokenStringLiteral& x);
-string to_string(const TokenNumber& x);
-
-using Token =
-    variant<TokenEof,
-            TokenWord,
-            TokenWspace,
-            TokenNumber,
-            TokenStringLiteral,
-            TokenImplicit,
-            ErrorInSourceFile  // error is flattened into Token to avoid
-                               // diffult-to-handle 2-level variant
-            >;
-
-int col(const Token& t);
-int length(const Token& t);
-Maybe<int> maybe_line_num(const Token& t);
-
-string to_string(const Token& x);
-
-struct TokenFifo
-{
-    const Token& front() const
-    {
-        assert(!empty());
-        return tokens.front();
-    }
-    Token& front()
-    {
-        assert(!empty());
-        return tokens.front();
-    }
-    const Token& at(int ix) const
-    {
-        assert(0 <= ix && ix < size());
-        return tokens[ix];
-    }
-    int size() const { return tokens.size(); }
-    void pop_front()
-    {
-        assert(!empty());
-        tokens.pop_front();
+        assert(!insert_implicit_tokens);
+        end_of_part = end;
     }
-    template <class T, class... Args>
-    void emplace_back(Args&&... args)
+    bool reached_end_of_part() const { return had_end_of_part; }
+    // For tokenizing from the middle of a file, call it before reading.
+    void set_first_line_num(int n)
     {
-        tokens.emplace_back(in_place_aggr_type<T>, std::forward<Args>(args)...);
+        assert(!started && n > 0);
+        line_num = n - 1;
     }
-    bool empty() const { return tokens.empty(); }
-
-private:
-    // TODO replace with a more cache friendly implementation if bottleneck
-    deque<Token> tokens;
-};
-
-struct Tokenizer
-{
-    // filename is for error msgs
-    Tokenizer(FileReader& fr, string filename)
-        : fr(fr), filename(move(filename))
-    {
-    }
-
-    Token& get_next_token();
-    void load_at_least(int n);
-    void read_next();
+    // The char used for indentation in the file, the first one found unless
+    // set.
+    void set_indent_char(char c) { maybe_file_indent_char = c; }
+    Maybe<char> indent_char() const { return maybe_file_indent_char; }
 
     TokenFifo fifo;
+    // payloads of the tokens read so far
+    TokenPayloads payloads;
 
 private:
     void pop_front();
 
     void read_indent();
     void read_within_line();
+    void read_token_identifier(int startcol, char first_char);
     void read_token_identifier(int startcol, string collector);
     void read_hex_literal(int startcol, char x_char);
     void read_token_number(int startcol, char first_char_digit);
-    long double read_fractional();
+    void read_string_literal(int startcol);
     void eof_reached(bool aborted_due_to_error);
+    void end_of_part_reached();
     void start_reading_line_skip_empty_lines();
     void continue_reading_line();
     void continue_reading_line(char c);
     void emplace_error(string_par msg, int startcol, int length);
     bool try_read_eol_after_first_char_read(char c);
     bool try_read_from_inline_comment_after_first_char_read(char c);
-    Maybe<char> maybe_resolve_escape_sequence_in_interpreted_literal();
+    Maybe<char> read_escape_sequence_in_interpreted_literal();
     int cur_col() const { return fr.chars_read() - current_line_start_pos; }
 
     FileReader& fr;
     string filename;
+    const ScanKernels& scan;
+    const bool insert_implicit_tokens;
+    IndentBlocks blocks;  // if insert_implicit_tokens
 
+    bool started = false;
     bool had_eof = false;
+    const char* end_of_part = nullptr;
+    bool had_end_of_part = false;
     int line_num = 0;  // 1-based, first line increases it to 1
     int current_line_start_pos = 0;
-    string strtmp;
     Maybe<char> maybe_file_indent_char;
 };
 
-using TokenSource = std::function<Token&()>;
+// The token pipeline is made of stages (Tokenizer, TokenImplicitInserter,
+// ...) which pull tokens from the previous stage in batches. A stage has
+//
+//     int fill(span<Token> out);
+//
+// which writes the next tokens to the beginning of `out` and returns their
+// number. It returns less than out.size() only after the Token::eof token
+// (which is the last one) and 0 after that. The stages are composed as
+// templates so a pipeline compiles into one loop; TokenBatchSource is for
+// the consumers which can't be templates, they pay for one virtual call per
+// batch.
+struct TokenBatchSource
+{
+    virtual int fill(span<Token> out) = 0;
+    virtual ~TokenBatchSource() {}
+};
+
+// TokenBatchSource reading from a stage.
+template <class Stage>
+class TokenBatchSourceOf : public TokenBatchSource
+{
+public:
+    explicit TokenBatchSourceOf(Stage& stage) : stage(stage) {}
+    int fill(span<Token> out) override { return stage.fill(out); }
+
+private:
+    Stage& stage;
+};
 }
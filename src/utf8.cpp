@@ -0,0 +1,78 @@
+#include "utf8.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || \
+    (defined(__i386__) && defined(__SSE2__))
+#define MAYBE_UTF8_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace maybe {
+
+// Return the first byte of [p, end) which is not ASCII, or end. The common
+// all-ASCII runs are skipped 16 bytes at a time.
+static const char* skip_ascii(const char* p, const char* end)
+{
+#ifdef MAYBE_UTF8_SSE2
+    for (; end - p >= 16; p += 16) {
+        int high_bits = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+        if (high_bits) {
+#ifdef _MSC_VER
+            unsigned long i;
+            _BitScanForward(&i, high_bits);
+            return p + i;
+#else
+            return p + __builtin_ctz(high_bits);
+#endif
+        }
+    }
+#endif
+    while (p < end && (uint8_t)*p < 0x80)
+        ++p;
+    return p;
+}
+
+const char* Utf8Validator::feed(const char* p, const char* end)
+{
+    for (;;) {
+        if (remaining == 0) {
+            p = skip_ascii(p, end);
+            if (p == end)
+                return nullptr;
+            const uint8_t b = *p;
+            lo = 0x80;
+            hi = 0xbf;
+            if (0xc2 <= b && b <= 0xdf) {
+                remaining = 1;
+            } else if (0xe0 <= b && b <= 0xef) {
+                remaining = 2;
+                if (b == 0xe0)
+                    lo = 0xa0;  // overlong
+                else if (b == 0xed)
+                    hi = 0x9f;  // surrogates
+            } else if (0xf0 <= b && b <= 0xf4) {
+                remaining = 3;
+                if (b == 0xf0)
+                    lo = 0x90;  // overlong
+                else if (b == 0xf4)
+                    hi = 0x8f;  // above U+10FFFF
+            } else {
+                // continuation byte without lead byte, 0xc0, 0xc1, > 0xf4
+                seen = 0;
+                return p;
+            }
+            seen = 1;
+            ++p;
+        }
+        for (; remaining > 0; --remaining, ++seen, ++p) {
+            if (p == end)
+                return nullptr;
+            const uint8_t b = *p;
+            if (b < lo || hi < b)
+                return p;
+            lo = 0x80;
+            hi = 0xbf;
+        }
+        seen = 0;
+    }
+}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "std.h"
+
+namespace maybe {
+
+static const array<char, 3> c_utf8_bom = {
+    {(char)0xef, (char)0xbb, (char)0xbf}};
+
+// Length of the sequence starting with `lead`, assuming valid UTF-8.
+inline int utf8_sequence_length(char lead)
+{
+    const uint8_t b = lead;
+    return b < 0xc0 ? 1 : b < 0xe0 ? 2 : b < 0xf0 ? 3 : 4;
+}
+
+// Incremental UTF-8 validator (Unicode Table 3-7: no overlong forms, no
+// surrogates, nothing above U+10FFFF). The input can be fed in pieces split
+// anywhere, even inside a multibyte sequence.
+class Utf8Validator
+{
+public:
+    // Validate the next piece [p, end). Return nullptr if it's valid so far,
+    // otherwise the first byte which can't continue a valid sequence.
+    const char* feed(const char* p, const char* end);
+
+    // True if the bytes fed so far end inside a multibyte sequence (which is
+    // an error at the end of the input).
+    bool incomplete() const { return remaining > 0; }
+
+    // Number of bytes of the current multibyte sequence already fed, so the
+    // sequence containing an error returned by feed() starts this many bytes
+    // before it (possibly in an earlier piece).
+    int sequence_bytes_seen() const { return seen; }
+
+private:
+    int remaining = 0;  // continuation bytes expected
+    int seen = 0;
+    uint8_t lo = 0x80, hi = 0xbf;  // range of the next continuation byte
+};
+}
@@ -1,13 +1,25 @@
 #include "utils.h"
+#include "consts.h"
+#include "log.h"
+#include "stats.h"
 
 namespace maybe {
 void report_error(const ErrorInSourceFile& x)
 {
     CHECK(!x.msg.empty() && !x.filename.empty());
+    stats.add(Counter::errors);
     if (x.has_location())
-        fmt::print(stderr, "{}:{}:{}: error: {}\n", x.filename, x.line_num,
-                   x.col, x.msg);
+        write_stderr(fmt::format("{}:{}:{}: error: {}\n", x.filename,
+                                 x.line_num, x.col, x.msg));
     else
-        fmt::print(stderr, "{}: error: {}\n", x.filename, x.msg);
+        write_stderr(fmt::format("{}: error: {}\n", x.filename, x.msg));
+}
+
+bool read_all(FILE* f, string& chars)
+{
+    array<char, c_filereader_read_buf_capacity> buf;
+    while (auto n = fread(buf.data(), 1, buf.size(), f))
+        chars.append(buf.data(), n);
+    return !ferror(f);
 }
 }
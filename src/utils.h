@@ -54,7 +54,7 @@ struct ErrorInSourceFile
                                       int line_num,
                                       int col)
     {
-        return ErrorInSourceFile{move(msg), move(filename), line_num, col, 0};
+        return ErrorInSourceFile{move(filename), move(msg), line_num, col, 0};
     }
     static ErrorInSourceFile from_flcl(string msg,
                                        string filename,
@@ -62,7 +62,7 @@ struct ErrorInSourceFile
                                        int col,
                                        int len)
     {
-        return ErrorInSourceFile{move(msg), move(filename), line_num, col, len};
+        return ErrorInSourceFile{move(filename), move(msg), line_num, col, len};
     }
     bool has_location() const { return line_num > 0 && col > 0; }
 
@@ -73,4 +73,7 @@ struct ErrorInSourceFile
     int length = 0;
 };
 void report_error(const ErrorInSourceFile& x);
+
+// Append the rest of `f` to `chars`, false on a read error.
+bool read_all(FILE* f, string& chars);
 }  // namespace maybe